@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+
+#include "futex.h"
+
+namespace logging {
+    enum class IdleStrategy : std::uint8_t {
+        // Never leaves the CPU, for a writer pinned to an isolated core.
+        BusySpin,
+        // Spins for spinIterations, then yields the CPU between polls.
+        SpinThenYield,
+        // Spins for spinIterations, then sleeps on a futex until a producer wakes it.
+        Sleep,
+    };
+
+    struct BackendOptions {
+        // CPUs the writer thread may run on, empty leaves the affinity untouched.
+        std::vector<int> cpus;
+        // SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO or SCHED_RR.
+        int schedPolicy = SCHED_OTHER;
+        // Static priority, only meaningful for SCHED_FIFO and SCHED_RR.
+        int schedPriority = 0;
+        // Nice value of the writer thread, only meaningful for the non real-time policies.
+        int niceValue = 0;
+        IdleStrategy idle = IdleStrategy::Sleep;
+        uint32_t spinIterations = 2000;
+        // Upper bound of a single futex sleep, so periodic work still runs on an idle logger.
+        std::chrono::milliseconds sleepTimeout{100};
+    };
+
+    // Background writer thread. It repeatedly calls poll, which returns whether it made
+    // progress, and idles according to the configured strategy when it did not.
+    class Backend {
+    public:
+        Backend(BackendOptions options, std::function<bool()> poll);
+        // Sleeps on a word owned by someone else, e.g. in memory other processes wake it
+        // through, in which case shared must be set for the futex calls.
+        Backend(BackendOptions options, std::function<bool()> poll, detail::Futex<>& sleeping, bool shared);
+
+        Backend(const Backend&) = delete;
+        Backend& operator=(const Backend&) = delete;
+        Backend(Backend&&) = delete;
+        Backend& operator=(Backend&&) = delete;
+
+        // Polls until poll reports no more work, then joins the thread.
+        ~Backend();
+
+        // Called by producers after publishing work. Costs a fence and a load unless the
+        // writer is asleep, in which case exactly one producer issues the futex wake.
+        void notify() noexcept {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping_.load(std::memory_order_relaxed) != 0) {
+                wake();
+            }
+        }
+
+    private:
+        void run();
+        void configureThread();
+        void wake() noexcept;
+
+        BackendOptions options_;
+        std::function<bool()> poll_;
+        std::atomic<bool> stop_{false};
+        alignas(64) detail::Futex<> own_sleeping_{0};
+        detail::Futex<>& sleeping_;
+        const bool shared_;
+        std::thread thread_;
+    };
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <source_location>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "log_level.h"
+
+namespace logging {
+    namespace detail {
+        template <typename T>
+        concept BacktraceString = std::convertible_to<T const&, std::string_view>;
+
+        // Values that format the same later as now. Anything else may point at memory that
+        // is gone by the time the backtrace is dumped.
+        template <typename T>
+        concept BacktraceValue = std::is_arithmetic_v<T> || std::is_enum_v<T> || std::same_as<T, void*> ||
+                                 std::same_as<T, const void*> || std::same_as<T, std::nullptr_t>;
+
+        template <typename T>
+        using BacktraceStored = std::conditional_t<BacktraceString<std::remove_cvref_t<T>>, std::string_view, std::remove_cvref_t<T>>;
+    }
+
+    // A record below its logger's threshold, kept with its arguments unformatted. Numbers
+    // are copied as they are and strings as length and bytes, so capturing costs a clock
+    // read and a few copies into a slot that is reused once the ring wraps.
+    struct BacktraceSlot {
+        static constexpr std::size_t kArgsSize = 192;
+
+        using Format = void (*)(fmt::memory_buffer&, BacktraceSlot const&);
+
+        Format format = nullptr;
+        // Format strings are literals, the view stays valid.
+        std::string_view formatString;
+        std::source_location loc;
+        int64_t time = 0;
+        uint16_t logger = 0;
+        LogLevel level = LogLevel::debug;
+        alignas(8) char args[kArgsSize];
+
+        template <typename... Args>
+        void capture(Args const&... values) {
+            using namespace detail;
+            constexpr std::size_t fixed = ((BacktraceString<std::remove_cvref_t<Args>> ? sizeof(uint32_t) : sizeof(Args)) + ... + 0);
+            if constexpr (((BacktraceString<std::remove_cvref_t<Args>> || BacktraceValue<std::remove_cvref_t<Args>>) && ...) && fixed <= kArgsSize) {
+                // Strings share whatever the fixed-size values leave, in argument order.
+                char* p = args;
+                std::size_t budget = kArgsSize - fixed;
+                (encode(p, budget, values), ...);
+                format = &formatCaptured<Args...>;
+            } else {
+                auto result = fmt::vformat_to_n(args + sizeof(uint32_t), kArgsSize - sizeof(uint32_t), formatString, fmt::make_format_args(values...));
+                uint32_t size = std::min<std::size_t>(result.size, kArgsSize - sizeof(uint32_t));
+                memcpy(args, &size, sizeof(size));
+                format = &formatText;
+            }
+        }
+
+    private:
+        template <typename T>
+        static void encode(char*& p, std::size_t& budget, T const& value) {
+            if constexpr (detail::BacktraceString<std::remove_cvref_t<T>>) {
+                std::string_view str(value);
+                uint32_t size = std::min(str.size(), budget);
+                budget -= size;
+                memcpy(p, &size, sizeof(size));
+                memcpy(p + sizeof(size), str.data(), size);
+                p += sizeof(size) + size;
+            } else {
+                memcpy(p, &value, sizeof(T));
+                p += sizeof(T);
+            }
+        }
+
+        template <typename T>
+        static detail::BacktraceStored<T> decode(const char*& p) {
+            if constexpr (detail::BacktraceString<std::remove_cvref_t<T>>) {
+                uint32_t size;
+                memcpy(&size, p, sizeof(size));
+                std::string_view str(p + sizeof(size), size);
+                p += sizeof(size) + size;
+                return str;
+            } else {
+                std::remove_cvref_t<T> value;
+                memcpy(&value, p, sizeof(value));
+                p += sizeof(value);
+                return value;
+            }
+        }
+
+        template <typename... Args>
+        static void formatCaptured(fmt::memory_buffer& buffer, BacktraceSlot const& slot) {
+            const char* p = slot.args;
+            // Braced initialization evaluates the decodes left to right.
+            std::tuple<detail::BacktraceStored<Args>...> values{decode<Args>(p)...};
+            std::apply([&](auto const&... args) {
+                fmt::vformat_to(fmt::appender(buffer), fmt::string_view(slot.formatString.data(), slot.formatString.size()), fmt::make_format_args(args...));
+            }, values);
+        }
+
+        static void formatText(fmt::memory_buffer& buffer, BacktraceSlot const& slot) {
+            uint32_t size;
+            memcpy(&size, slot.args, sizeof(size));
+            buffer.append(slot.args + sizeof(size), slot.args + sizeof(size) + size);
+        }
+    };
+
+    // Per-thread ring of the most recent captured records of one Log.
+    class BacktraceRing {
+    public:
+        bool ownedBy(uint64_t owner, std::size_t depth) const noexcept {
+            return owner_ == owner && slots_.size() == depth;
+        }
+
+        void reset(uint64_t owner, std::size_t depth) {
+            owner_ = owner;
+            slots_.assign(depth, BacktraceSlot{});
+            next_ = 0;
+            count_ = 0;
+        }
+
+        BacktraceSlot& next() noexcept {
+            BacktraceSlot& slot = slots_[next_];
+            next_ = next_ + 1 == slots_.size() ? 0 : next_ + 1;
+            count_ = std::min(count_ + 1, slots_.size());
+            return slot;
+        }
+
+        // Oldest first, and empties the ring.
+        template <typename F>
+        void drain(F&& f) {
+            std::size_t index = (next_ + slots_.size() - count_) % std::max<std::size_t>(slots_.size(), 1);
+            for (std::size_t i = 0; i < count_; ++i) {
+                f(slots_[index]);
+                index = index + 1 == slots_.size() ? 0 : index + 1;
+            }
+            count_ = 0;
+        }
+
+    private:
+        uint64_t owner_ = 0;
+        std::vector<BacktraceSlot> slots_;
+        std::size_t next_ = 0;
+        std::size_t count_ = 0;
+    };
+}
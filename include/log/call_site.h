@@ -0,0 +1,174 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <source_location>
+
+#include <time.h>
+
+namespace logging {
+    struct RateLimit {
+        // Admitted messages per second for each call site, 0 disables the token bucket.
+        uint32_t messagesPerSecond = 0;
+        uint32_t burst = 1;
+        // Keep on average one message in sampleOneIn, 1 keeps every message.
+        uint32_t sampleOneIn = 1;
+        // Minimum distance between two "suppressed N messages" lines of one site.
+        uint32_t summaryIntervalMs = 1000;
+
+        bool enabled() const noexcept { return messagesPerSecond != 0 || sampleOneIn > 1; }
+    };
+
+    // A RateLimit that may be replaced while producers read it. Fields are loaded one by
+    // one, so a reader racing a store can see a mix of the old and the new limit.
+    class AtomicRateLimit {
+    public:
+        void store(RateLimit const& limit) noexcept {
+            messagesPerSecond_.store(limit.messagesPerSecond, std::memory_order_relaxed);
+            burst_.store(limit.burst, std::memory_order_relaxed);
+            sampleOneIn_.store(limit.sampleOneIn, std::memory_order_relaxed);
+            summaryIntervalMs_.store(limit.summaryIntervalMs, std::memory_order_relaxed);
+        }
+
+        RateLimit load() const noexcept {
+            return RateLimit{messagesPerSecond_.load(std::memory_order_relaxed), burst_.load(std::memory_order_relaxed),
+                             sampleOneIn_.load(std::memory_order_relaxed), summaryIntervalMs_.load(std::memory_order_relaxed)};
+        }
+
+    private:
+        std::atomic<uint32_t> messagesPerSecond_{0};
+        std::atomic<uint32_t> burst_{1};
+        std::atomic<uint32_t> sampleOneIn_{1};
+        std::atomic<uint32_t> summaryIntervalMs_{1000};
+    };
+
+    // Per call site state of one Log, created on first use and destroyed with the Log.
+    class CallSite {
+    public:
+        // Decides whether a message may be formatted. Rejection costs a few loads and one
+        // relaxed increment, and happens before any argument is touched.
+        bool admit(RateLimit const& limit) noexcept {
+            if (limit.sampleOneIn > 1 && !sample(limit.sampleOneIn)) {
+                suppressed_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (limit.messagesPerSecond == 0) {
+                return true;
+            }
+
+            const int64_t now = coarseNow();
+            const int64_t interval = 1000000000 / limit.messagesPerSecond;
+            const int64_t tolerance = interval * std::max<uint32_t>(limit.burst, 1);
+
+            // Generic cell rate algorithm: a token bucket folded into a single timestamp.
+            int64_t tat = tat_.load(std::memory_order_relaxed);
+            while (true) {
+                const int64_t next = std::max(tat, now) + interval;
+                if (next - now > tolerance) {
+                    suppressed_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (tat_.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+        }
+
+        // Returns the number of messages suppressed since the last summary once the summary
+        // interval has elapsed, and 0 otherwise.
+        uint64_t takeSuppressed(RateLimit const& limit, bool force = false) noexcept {
+            if (suppressed_.load(std::memory_order_relaxed) == 0) {
+                return 0;
+            }
+            const int64_t now = coarseNow();
+            int64_t last = lastSummary_.load(std::memory_order_relaxed);
+            if (!force && now - last < int64_t{limit.summaryIntervalMs} * 1000000) {
+                return 0;
+            }
+            if (!lastSummary_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+                return 0;
+            }
+            return suppressed_.exchange(0, std::memory_order_relaxed);
+        }
+
+        std::source_location const& location() const noexcept { return loc_; }
+
+    private:
+        friend class CallSiteTable;
+
+        explicit CallSite(std::source_location const& loc) noexcept : loc_(loc) {}
+
+        static std::size_t hash(std::source_location const& loc) noexcept {
+            uint64_t h = reinterpret_cast<uintptr_t>(loc.file_name());
+            h ^= (uint64_t{loc.line()} << 16) ^ loc.column();
+            h *= 0x9E3779B97F4A7C15ull;
+            return static_cast<std::size_t>(h >> 32);
+        }
+
+        bool matches(std::source_location const& loc) const noexcept {
+            return loc_.file_name() == loc.file_name() && loc_.line() == loc.line() && loc_.column() == loc.column();
+        }
+
+        static int64_t coarseNow() noexcept {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return int64_t{ts.tv_sec} * 1000000000 + ts.tv_nsec;
+        }
+
+        static bool sample(uint32_t oneIn) noexcept {
+            thread_local uint64_t state = reinterpret_cast<uintptr_t>(&state) | 1;
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return ((state >> 32) * oneIn >> 32) == 0;
+        }
+
+        std::source_location loc_;
+        alignas(64) std::atomic<int64_t> tat_{0};
+        std::atomic<uint64_t> suppressed_{0};
+        std::atomic<int64_t> lastSummary_{0};
+    };
+
+    // The call sites of one Log. Sites are keyed by the file name pointer, line and column
+    // of the std::source_location captured at the call, and live as long as the table.
+    class CallSiteTable {
+    public:
+        static constexpr std::size_t kCapacity = 4096;
+
+        CallSiteTable() = default;
+        CallSiteTable(const CallSiteTable&) = delete;
+        CallSiteTable& operator=(const CallSiteTable&) = delete;
+        ~CallSiteTable();
+
+        CallSite& of(std::source_location const& loc) noexcept {
+            std::size_t idx = CallSite::hash(loc) & (kCapacity - 1);
+            for (std::size_t probe = 0; probe < kCapacity; ++probe) {
+                CallSite* site = table_[idx].load(std::memory_order_acquire);
+                if (site == nullptr) {
+                    return insert(loc, idx);
+                }
+                if (site->matches(loc)) {
+                    return *site;
+                }
+                idx = (idx + 1) & (kCapacity - 1);
+            }
+            return overflow_;
+        }
+
+        template <typename F>
+        void forEach(F&& f) {
+            for (auto& slot : table_) {
+                if (CallSite* site = slot.load(std::memory_order_acquire)) {
+                    f(*site);
+                }
+            }
+        }
+
+    private:
+        CallSite& insert(std::source_location const& loc, std::size_t idx) noexcept;
+
+        std::atomic<CallSite*> table_[kCapacity] = {};
+        CallSite overflow_{std::source_location{}};
+    };
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+
+#include <liburing.h>
+
+namespace logging {
+    // Point in time after which an engine's writers stop waiting for completions. It can
+    // be set from another thread while a writer is already waiting.
+    class Deadline {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        void set(Clock::time_point when) noexcept {
+            at_.store(when.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        bool passed() const noexcept {
+            auto at = at_.load(std::memory_order_relaxed);
+            return at != kNever && Clock::now().time_since_epoch().count() >= at;
+        }
+
+        // io_uring_wait_cqe that returns -ETIME once the deadline has passed. Waits in
+        // slices, so a deadline set during the wait is noticed within one of them. A wait
+        // interrupted by a signal is resumed, any other error is returned.
+        int waitCqe(struct io_uring* ring, struct io_uring_cqe** cqe) const noexcept {
+            while (true) {
+                if (io_uring_peek_cqe(ring, cqe) == 0) {
+                    return 0;
+                }
+                auto at = at_.load(std::memory_order_relaxed);
+                auto left = Clock::duration(at - Clock::now().time_since_epoch().count());
+                if (at != kNever && left <= Clock::duration::zero()) {
+                    return -ETIME;
+                }
+
+                auto slice = std::chrono::duration_cast<std::chrono::nanoseconds>(at == kNever ? kSlice : std::min<Clock::duration>(left, kSlice));
+                struct __kernel_timespec ts = {0, static_cast<long long>(slice.count())};
+                int result = io_uring_wait_cqe_timeout(ring, cqe, &ts);
+                if (result != -ETIME && result != -EINTR) {
+                    return result;
+                }
+            }
+        }
+
+    private:
+        static constexpr Clock::rep kNever = Clock::duration::max().count();
+        static constexpr std::chrono::milliseconds kSlice{100};
+
+        std::atomic<Clock::rep> at_{kNever};
+    };
+}
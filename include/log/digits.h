@@ -0,0 +1,234 @@
+#pragma once
+#include <bit>
+#include <concepts>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <fmt/format.h>
+
+// Digit kernels for the argument types that dominate log lines. Every function writes to
+// out, which must have room for the documented maximum, and returns the end of the output.
+namespace logging::digits {
+    inline constexpr std::size_t kMaxDecimal = 20;
+    inline constexpr std::size_t kMaxHex = 16;
+    inline constexpr std::size_t kMaxDouble = 32;
+
+    namespace detail {
+        inline constexpr char kPairs[201] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899";
+
+        inline constexpr uint64_t kPowers10[] = {
+            1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+            100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+            10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+            100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+        };
+
+        // Branchless digit count: the bit width gives a guess that is off by at most one.
+        inline int countDigits(uint64_t value) noexcept {
+            int guess = (std::bit_width(value | 1) * 1233) >> 12;
+            return guess + ((value | 1) >= kPowers10[guess]);
+        }
+
+        // Writes exactly digits characters, two at a time from the back.
+        inline void writeScalar(char* out, uint32_t value, int digits) noexcept {
+            char* p = out + digits;
+            while (value >= 100) {
+                p -= 2;
+                memcpy(p, kPairs + (value % 100) * 2, 2);
+                value /= 100;
+            }
+            if (value >= 10) {
+                memcpy(p - 2, kPairs + value * 2, 2);
+            } else {
+                p[-1] = static_cast<char>('0' + value);
+            }
+            // Zero fill whatever the value did not reach, for padded fields.
+            for (char* q = out; q < p - (value >= 10 ? 2 : 1); ++q) {
+                *q = '0';
+            }
+        }
+
+#if defined(__SSE2__)
+        // Eight zero-padded digits of a value below 10^8, computed for all digits at once
+        // with multiply-high by reciprocals (after W. Mula's and M. Yip's itoa kernels).
+        inline __m128i eightDigits(uint32_t value) noexcept {
+            const __m128i div10000 = _mm_set1_epi32(static_cast<int>(0xd1b71759));
+            const __m128i mul10000 = _mm_set1_epi32(10000);
+            const __m128i divPowers = _mm_setr_epi16(8389, 5243, 13108, static_cast<short>(32768), 8389, 5243, 13108, static_cast<short>(32768));
+            const __m128i shiftPowers = _mm_setr_epi16(1 << (16 - (23 + 2 - 16)), 1 << (16 - (19 + 2 - 16)), 1 << (16 - 1 - 2), 1 << 15,
+                                                       1 << (16 - (23 + 2 - 16)), 1 << (16 - (19 + 2 - 16)), 1 << (16 - 1 - 2), 1 << 15);
+            const __m128i mul10 = _mm_set1_epi16(10);
+
+            // abcd, efgh = abcdefgh divmod 10000
+            const __m128i abcdefgh = _mm_cvtsi32_si128(static_cast<int>(value));
+            const __m128i abcd = _mm_srli_epi64(_mm_mul_epu32(abcdefgh, div10000), 45);
+            const __m128i efgh = _mm_sub_epi32(abcdefgh, _mm_mul_epu32(abcd, mul10000));
+
+            // Each half broadcast to four lanes, pre-multiplied by 4 for the reciprocals.
+            const __m128i v1 = _mm_slli_epi64(_mm_unpacklo_epi16(abcd, efgh), 2);
+            const __m128i v2 = _mm_unpacklo_epi32(_mm_unpacklo_epi16(v1, v1), _mm_unpacklo_epi16(v1, v1));
+
+            // [a, ab, abc, abcd, e, ef, efg, efgh] minus ten times the lane to its left.
+            const __m128i v4 = _mm_mulhi_epu16(_mm_mulhi_epu16(v2, divPowers), shiftPowers);
+            const __m128i v6 = _mm_slli_epi64(_mm_mullo_epi16(v4, mul10), 16);
+            return _mm_sub_epi16(v4, v6);
+        }
+
+        inline void writeEight(char* out, uint32_t value) noexcept {
+            const __m128i digits = _mm_packus_epi16(eightDigits(value), _mm_setzero_si128());
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_add_epi8(digits, _mm_set1_epi8('0')));
+        }
+
+        inline void writeSixteen(char* out, uint64_t value) noexcept {
+            const __m128i digits = _mm_packus_epi16(eightDigits(static_cast<uint32_t>(value / 100000000)),
+                                                    eightDigits(static_cast<uint32_t>(value % 100000000)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_add_epi8(digits, _mm_set1_epi8('0')));
+        }
+#else
+        inline void writeEight(char* out, uint32_t value) noexcept {
+            writeScalar(out, value, 8);
+        }
+
+        inline void writeSixteen(char* out, uint64_t value) noexcept {
+            writeScalar(out, static_cast<uint32_t>(value / 100000000), 8);
+            writeScalar(out + 8, static_cast<uint32_t>(value % 100000000), 8);
+        }
+#endif
+    }
+
+    inline char* writeUnsigned(char* out, uint64_t value) noexcept {
+        if (value < 100000000) {
+            int digits = detail::countDigits(value);
+            detail::writeScalar(out, static_cast<uint32_t>(value), digits);
+            return out + digits;
+        }
+        if (value < 10000000000000000ull) {
+            uint32_t high = static_cast<uint32_t>(value / 100000000);
+            int digits = detail::countDigits(high);
+            detail::writeScalar(out, high, digits);
+            detail::writeEight(out + digits, static_cast<uint32_t>(value % 100000000));
+            return out + digits + 8;
+        }
+        uint32_t high = static_cast<uint32_t>(value / 10000000000000000ull);
+        int digits = detail::countDigits(high);
+        detail::writeScalar(out, high, digits);
+        detail::writeSixteen(out + digits, value % 10000000000000000ull);
+        return out + digits + 16;
+    }
+
+    // kMaxDecimal + 1 bytes for signed types.
+    template <std::integral T>
+    inline char* writeDecimal(char* out, T value) noexcept {
+        uint64_t magnitude = static_cast<uint64_t>(value);
+        if constexpr (std::is_signed_v<T>) {
+            if (value < 0) {
+                *out++ = '-';
+                magnitude = 0 - magnitude;
+            }
+        }
+        return writeUnsigned(out, magnitude);
+    }
+
+    // Exactly width digits, width at most 16. The value must fit.
+    inline char* writeDecimalPadded(char* out, uint64_t value, int width) noexcept {
+        if (width == 9) {
+            // The nanoseconds of every prefix.
+            *out = static_cast<char>('0' + value / 100000000);
+            detail::writeEight(out + 1, static_cast<uint32_t>(value % 100000000));
+        } else if (width <= 8) {
+            detail::writeScalar(out, static_cast<uint32_t>(value), width);
+        } else {
+            detail::writeScalar(out, static_cast<uint32_t>(value / 100000000), width - 8);
+            detail::writeEight(out + width - 8, static_cast<uint32_t>(value % 100000000));
+        }
+        return out + width;
+    }
+
+    // Lower case, no leading zeros and no prefix.
+    inline char* writeHex(char* out, uint64_t value) noexcept {
+        int digits = (std::bit_width(value | 1) + 3) / 4;
+#if defined(__SSE2__)
+        // One nibble per byte, most significant first, then mapped to '0'-'9' and 'a'-'f'.
+        const __m128i bytes = _mm_cvtsi64_si128(static_cast<long long>(__builtin_bswap64(value)));
+        const __m128i mask = _mm_set1_epi8(0x0f);
+        const __m128i nibbles = _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask), _mm_and_si128(bytes, mask));
+        const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+        alignas(16) char text[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(text), _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters));
+        memcpy(out, text + 16 - digits, digits);
+#else
+        for (int i = digits - 1; i >= 0; --i, value >>= 4) {
+            out[i] = "0123456789abcdef"[value & 0xf];
+        }
+#endif
+        return out + digits;
+    }
+
+    // Shortest round-trip digits laid out like fmt's "{}": fixed notation for decimal
+    // exponents in [-4, 16), scientific otherwise. Non-finite values are not handled.
+    template <typename T> requires std::same_as<T, double> || std::same_as<T, float>
+    inline char* writeFloating(char* out, T value) noexcept {
+        if (std::signbit(value)) {
+            *out++ = '-';
+            value = -value;
+        }
+        if (value == 0) {
+            *out = '0';
+            return out + 1;
+        }
+
+        // fmt's Dragonbox, exported by the fmt build we pin, yields the shortest digits
+        // and their exponent; only the layout is done here.
+        auto decimal = fmt::detail::dragonbox::to_decimal(value);
+        char digits[kMaxDecimal];
+        int count = writeUnsigned(digits, decimal.significand) - digits;
+        int exp = decimal.exponent + count - 1;
+
+        if (exp < -4 || exp >= 16) {
+            *out++ = digits[0];
+            if (count > 1) {
+                *out++ = '.';
+                memcpy(out, digits + 1, count - 1);
+                out += count - 1;
+            }
+            *out++ = 'e';
+            *out++ = exp < 0 ? '-' : '+';
+            unsigned magnitude = exp < 0 ? -exp : exp;
+            if (magnitude < 10) {
+                *out++ = '0';
+            }
+            return writeUnsigned(out, magnitude);
+        }
+        if (exp < 0) {
+            memcpy(out, "0.0000", 1 - exp);
+            out += 1 - exp;
+            memcpy(out, digits, count);
+            return out + count;
+        }
+        if (count <= exp + 1) {
+            memcpy(out, digits, count);
+            memset(out + count, '0', exp + 1 - count);
+            return out + exp + 1;
+        }
+        memcpy(out, digits, exp + 1);
+        out[exp + 1] = '.';
+        memcpy(out + exp + 2, digits + exp + 1, count - exp - 1);
+        return out + count + 1;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <liburing.h>
+#include <sys/uio.h>
+
+#include "deadline.h"
+#include "memory.h"
+
+namespace logging {
+    // Appends records to a file opened with O_DIRECT. Records are assembled into
+    // block-aligned buffers registered with the ring. Only whole blocks are written,
+    // except on flush, where the trailing partial block is written zero-padded. That
+    // block stays in the buffer and is rewritten in place by the next flush. Until the
+    // writer is destroyed the file ends with the padding, which is trimmed on close, and
+    // on reopen after a crash. Extents are preallocated ahead of the write cursor with
+    // fallocate, truncating on every flush would release them. Once a wait for a write outlasts the deadline the writer
+    // gives up: the buffers may still be read by the kernel, so nothing is written anymore.
+    // Not thread-safe, the owner serializes calls.
+    class DirectWriter {
+    public:
+        static constexpr size_t kBlockSize = 4096;
+        static constexpr size_t kBufferSize = 64 * 1024;
+        static constexpr size_t kBufferCount = 4;
+
+        DirectWriter(struct io_uring& ring, Deadline const& deadline, int fd, uint64_t preallocate_bytes, MemoryOptions const& memory = {});
+
+        DirectWriter(const DirectWriter&) = delete;
+        DirectWriter& operator=(const DirectWriter&) = delete;
+
+        // Flushes and releases the preallocated extents past the end of the log.
+        ~DirectWriter();
+
+        void append(const struct iovec*, int);
+
+        // Writes everything appended so far and waits for the writes to complete. False
+        // if a write since the last flush failed or came up short, and once the writer gave
+        // up, what was appended since is dropped.
+        bool flush();
+
+    private:
+        struct Buffer {
+            char* data = nullptr;
+            // Of the write in flight.
+            size_t length = 0;
+            bool in_flight = false;
+        };
+
+        void submitBuffer(size_t len);
+        void nextBuffer();
+        bool reap();
+        void abandon();
+        void preallocate(uint64_t end);
+
+        struct io_uring& ring_;
+        Deadline const& deadline_;
+        int fd_;
+        uint64_t preallocate_bytes_;
+        MemoryOptions memory_;
+        bool registered_ = false;
+        bool abandoned_ = false;
+        // A write failed or came up short since the last flush.
+        bool failed_ = false;
+
+        Buffer buffers_[kBufferCount];
+        size_t current_ = 0;
+        size_t fill_ = 0;
+        uint32_t in_flight_ = 0;
+        // File offset of the first byte of the current buffer, always block aligned.
+        uint64_t offset_ = 0;
+        uint64_t allocated_ = 0;
+    };
+}
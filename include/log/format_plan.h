@@ -0,0 +1,126 @@
+#pragma once
+#include <concepts>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "digits.h"
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
+
+namespace logging {
+    // A format string split at compile time into literal runs, each optionally followed by
+    // a plain "{}" placeholder. Strings with format specs, explicit argument indices or more
+    // than kMaxSegments runs are left unplanned and go through fmt::vformat_to.
+    class FormatPlan {
+    public:
+        static constexpr std::size_t kMaxSegments = 16;
+
+        constexpr FormatPlan() = default;
+
+        consteval explicit FormatPlan(std::string_view fmt) {
+            std::size_t begin = 0;
+            std::size_t i = 0;
+            while (i < fmt.size()) {
+                char c = fmt[i];
+                if (c != '{' && c != '}') {
+                    ++i;
+                    continue;
+                }
+
+                bool escaped = i + 1 < fmt.size() && fmt[i + 1] == c;
+                if (!escaped && (c == '}' || i + 1 == fmt.size() || fmt[i + 1] != '}')) {
+                    return;
+                }
+                // "{{" and "}}" keep the first brace in the literal and skip the second.
+                if (!push(begin, escaped ? i + 1 : i, !escaped)) {
+                    return;
+                }
+                i += 2;
+                begin = i;
+            }
+            if (begin != fmt.size() && !push(begin, fmt.size(), false)) {
+                return;
+            }
+            valid_ = true;
+        }
+
+        bool matches(std::size_t num_args) const noexcept { return valid_ && args_ == num_args; }
+
+        // Only valid when matches(sizeof...(Args)).
+        template <typename... Args>
+        void formatTo(fmt::memory_buffer& out, std::string_view fmt, Args const&... args) const {
+            std::size_t next = 0;
+            auto literalsUntilArg = [&] {
+                while (next < count_) {
+                    Segment const& segment = segments_[next++];
+                    out.append(fmt.data() + segment.offset, fmt.data() + segment.offset + segment.size);
+                    if (segment.arg) {
+                        return;
+                    }
+                }
+            };
+            ((literalsUntilArg(), appendArg(out, args)), ...);
+            literalsUntilArg();
+        }
+
+    private:
+        struct Segment {
+            uint16_t offset = 0;
+            uint16_t size = 0;
+            bool arg = false;
+        };
+
+        consteval bool push(std::size_t begin, std::size_t end, bool arg) {
+            if (count_ == kMaxSegments || end > UINT16_MAX) {
+                return false;
+            }
+            segments_[count_++] = Segment{static_cast<uint16_t>(begin), static_cast<uint16_t>(end - begin), arg};
+            args_ += arg;
+            return true;
+        }
+
+        template <typename T>
+        static void appendArg(fmt::memory_buffer& out, T const& arg) {
+            using U = std::remove_cvref_t<T>;
+            if constexpr (std::integral<U> && !std::same_as<U, bool> && !std::same_as<U, char>) {
+                appendWith(out, digits::kMaxDecimal + 1, [&](char* p) { return digits::writeDecimal(p, arg); });
+            } else if constexpr (std::same_as<U, double> || std::same_as<U, float>) {
+                if (std::isfinite(arg)) {
+                    appendWith(out, digits::kMaxDouble, [&](char* p) { return digits::writeFloating(p, arg); });
+                } else {
+                    fmt::format_to(fmt::appender(out), FMT_COMPILE("{}"), arg);
+                }
+            } else if constexpr (std::same_as<U, void*> || std::same_as<U, const void*>) {
+                appendWith(out, digits::kMaxHex + 2, [&](char* p) {
+                    memcpy(p, "0x", 2);
+                    return digits::writeHex(p + 2, reinterpret_cast<uintptr_t>(arg));
+                });
+            } else if constexpr (std::convertible_to<T const&, std::string_view>) {
+                std::string_view str(arg);
+                out.append(str.data(), str.data() + str.size());
+            } else {
+                // Still specialized for T at compile time, just without a hand-written path.
+                fmt::format_to(fmt::appender(out), FMT_COMPILE("{}"), arg);
+            }
+        }
+
+        // Lets a kernel write straight into the buffer, max bytes are made available first.
+        template <typename F>
+        static void appendWith(fmt::memory_buffer& out, std::size_t max, F&& write) {
+            std::size_t size = out.size();
+            out.resize(size + max);
+            char* end = write(out.data() + size);
+            out.resize(end - out.data());
+        }
+
+        Segment segments_[kMaxSegments]{};
+        uint8_t count_ = 0;
+        uint8_t args_ = 0;
+        bool valid_ = false;
+    };
+}
@@ -11,6 +11,10 @@
 #define FUTEX_WAIT_BITSET 9
 #endif
 
+#ifndef FUTEX_WAKE_BITSET
+#define FUTEX_WAKE_BITSET 10
+#endif
+
 #ifndef FUTEX_PRIVATE_FLAG
 #define FUTEX_PRIVATE_FLAG 128
 #endif
@@ -26,10 +30,12 @@ namespace detail {
     template <template <typename> class Atom = std::atomic>
     using Futex = Atom<std::uint32_t>;
 
+    // Futexes are private to the process unless shared is set, which a futex in memory
+    // mapped by several processes needs on both the waiting and the waking side.
     FutexResult nativeFutexWaitImpl(const void* addr, uint32_t expected, std::chrono::system_clock::time_point const* absSystemTime,
-                                    std::chrono::steady_clock::time_point const* absSteadyTime, uint32_t waitMask);
+                                    std::chrono::steady_clock::time_point const* absSteadyTime, uint32_t waitMask, bool shared = false);
 
-    int nativeFutexWakeImpl(const void* addr, int count, uint32_t wakeMask);
+    int nativeFutexWakeImpl(const void* addr, int count, uint32_t wakeMask, bool shared = false);
 
     template <class Clock>
     timespec timeSpecFromTimePoint(std::chrono::time_point<Clock> absTime) {
@@ -48,34 +54,21 @@ namespace detail {
     }
 
     template <typename Futex>
-    FutexResult futexWait(const Futex* futex, uint32_t expected, uint32_t waitMask = -1) {
-        auto rv = nativeFutexWaitImpl(futex, expected, nullptr, nullptr, waitMask);
+    FutexResult futexWait(const Futex* futex, uint32_t expected, uint32_t waitMask = -1, bool shared = false) {
+        auto rv = nativeFutexWaitImpl(futex, expected, nullptr, nullptr, waitMask, shared);
         assert(rv != FutexResult::TIMEDOUT);
         return rv;
     }
 
     template <typename Futex, typename Deadline>
-    FutexResult futexWaitImpl(Futex* futex, uint32_t expected, Deadline const& deadline, uint32_t waitMask) {
+    FutexResult futexWaitImpl(Futex* futex, uint32_t expected, Deadline const& deadline, uint32_t waitMask, bool shared) {
         if constexpr (Deadline::clock::is_steady) {
-            return nativeFutexWaitImpl(futex, expected, nullptr, &deadline, waitMask);
+            return nativeFutexWaitImpl(futex, expected, nullptr, &deadline, waitMask, shared);
         } else {
-            return nativeFutexWaitImpl(futex, expected, &deadline, nullptr, waitMask);
+            return nativeFutexWaitImpl(futex, expected, &deadline, nullptr, waitMask, shared);
         }
     }
 
-    template <typename Futex, class Clock, class Duration>
-    FutexResult futexWaitUntil(const Futex* futex, uint32_t expected, std::chrono::time_point<Clock, Duration> const& deadline, uint32_t waitMask = -1) {
-        using Target = typename std::conditional<Clock::is_steady, std::chrono::steady_clock, std::chrono::system_clock>::type;
-
-        auto const converted = time_point_conv<Target>(deadline);
-        return converted == Target::time_point::max() ? nativeFutexWaitImpl(futex, expected, nullptr, nullptr, waitMask) : futexWaitImpl(futex, expected, converted, waitMask);
-    }
-
-    template <typename Futex>
-    int futexWake(const Futex* futex, int count = std::numeric_limits<int>::max(), uint32_t wakeMask = -1) {
-        return nativeFutexWakeImpl(futex, count, wakeMask);
-    }
-
     template <typename TargetClock, typename Clock, typename Duration>
     typename TargetClock::time_point time_point_conv(std::chrono::time_point<Clock, Duration> const& time) {
         using std::chrono::duration_cast;
@@ -94,4 +87,17 @@ namespace detail {
             }
         }
     }
+
+    template <typename Futex, class Clock, class Duration>
+    FutexResult futexWaitUntil(const Futex* futex, uint32_t expected, std::chrono::time_point<Clock, Duration> const& deadline, uint32_t waitMask = -1, bool shared = false) {
+        using Target = typename std::conditional<Clock::is_steady, std::chrono::steady_clock, std::chrono::system_clock>::type;
+
+        auto const converted = time_point_conv<Target>(deadline);
+        return converted == Target::time_point::max() ? nativeFutexWaitImpl(futex, expected, nullptr, nullptr, waitMask, shared) : futexWaitImpl(futex, expected, converted, waitMask, shared);
+    }
+
+    template <typename Futex>
+    int futexWake(const Futex* futex, int count = std::numeric_limits<int>::max(), uint32_t wakeMask = -1, bool shared = false) {
+        return nativeFutexWakeImpl(futex, count, wakeMask, shared);
+    }
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+#pragma once
 #include <liburing.h>
 #include <vector>
 #include <thread>
@@ -7,10 +8,17 @@
 #include <string>
 #include <string_view>
 #include <mutex>
+#include <memory>
 #include "turn_sequencer.h"
+#include "deadline.h"
+#include "direct_writer.h"
+#include "socket_sink.h"
+#include "pipe_sink.h"
+#include "io_engine.h"
 #include <fcntl.h>      // For O_WRONLY, O_CREAT, O_APPEND
 #include <sys/types.h>  // For open()
 #include <sys/stat.h>   // For file permissions (S_IRUSR, S_IWUSR)
+#include <sys/uio.h>    // For struct iovec
 
 #include <unistd.h>     // For close()
 #define QUEUE_DEPTH 100
@@ -20,9 +28,11 @@
 struct io_uring_buf_ring;
 
 namespace logging {
-    class IoContext {
+    // The io_uring engine.
+    class IoContext : public IoEngine {
     public:
         IoContext();
+        explicit IoContext(IoOptions);
 
         IoContext(const IoContext&) = delete;
 
@@ -32,17 +42,51 @@ namespace logging {
 
         IoContext& operator=(IoContext&&) = delete;
 
-        ~IoContext();
+        ~IoContext() override;
 
-        int register_file(std::string_view);
-        void write(const char*, size_t);
+        const char* name() const noexcept override { return "io_uring"; }
+
+        int register_file(std::string_view) override;
+        // Also sends every record to the Unix domain socket at path. Without a file the
+        // socket is the only output.
+        int register_socket(std::string_view path, SocketOptions options = {}) override;
+        // Also feeds every record to the write end of a pipe, which is made non-blocking.
+        // Borrowed writes are spliced, submit() then also waits for the reader to take
+        // them. The descriptor stays the caller's to close.
+        int register_pipe(int fd) override;
+        void writev(const struct iovec*, int) override;
+        void writevBorrowed(const struct iovec*, int) override;
+        // Submits the queued writes and waits for their completions.
+        bool submit() override;
+        bool abandoned() const noexcept override { return abandoned_.load(std::memory_order_acquire); }
+        // Writes the file and the socket still wait for at the deadline are left to the
+        // kernel, as are spliced records the pipe's reader has not taken yet. Records the
+        // pipe has no room for are dropped.
+        void setDeadline(std::chrono::steady_clock::time_point) override;
 
     private:
+        // Hands an SQE of the ring to prep and submits once half the queue depth is pending.
+        template <typename Prep>
+        void queueSqe(Prep&& prep);
+        bool submitRing(struct io_uring&, uint32_t count);
+        uint64_t reserveOffset(size_t len);
+
+        IoOptions options_;
+        Deadline deadline_;
+        std::atomic<bool> abandoned_{false};
+        std::atomic<uint64_t> file_offset_{0};
+        std::mutex direct_mutex_;
+        std::unique_ptr<DirectWriter> direct_;
+        std::mutex socket_mutex_;
+        std::unique_ptr<SocketSink> socket_;
+        std::mutex pipe_mutex_;
+        std::unique_ptr<PipeSink> pipe_;
+
         struct io_uring io_uring_;
-        int fds[2];
+        int fds[2] = {-1, -1};
         std::atomic<uint32_t> count_{0};
         std::atomic<uint32_t> turn_{0};
         TurnSequencer<std::atomic> turn_sequencer_;
-        alignas(64) std::atomic<uint32_t> spinCutoff_;
+        alignas(64) std::atomic<uint32_t> spinCutoff_{0};
     };
 }
\ No newline at end of file
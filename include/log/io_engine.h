@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include <sys/uio.h>
+
+#include "memory.h"
+#include "socket_sink.h"
+
+namespace logging {
+    enum class IoEngineKind : uint8_t {
+        // io_uring, or pwritev where the ring cannot be set up (e.g. seccomp blocks io_uring_setup).
+        Auto,
+        IoUring,
+        // writev(2) to the file opened with O_APPEND, from the writing thread, the backend's
+        // writer when there is one.
+        Pwritev,
+        // Copies into a shared mapping of the file, the page cache writes it back.
+        Mmap,
+    };
+
+    struct IoOptions {
+        IoEngineKind engine = IoEngineKind::Auto;
+        // Backing of the Log's queues and of the engine's I/O buffers. The queues still
+        // pick their own NUMA node.
+        MemoryOptions memory;
+        // The options below only apply to the io_uring engine. It has one ring, a Log's
+        // records reach it from one writer at a time.
+        //
+        // Reserve file offsets at write time so the file holds records in call order across
+        // threads writing to the engine directly. Otherwise the file is O_APPEND.
+        bool globalOrder = false;
+        // Open the file with O_DIRECT and write block-aligned buffers that bypass the page
+        // cache.
+        bool directIo = false;
+        // Extent preallocation ahead of the write cursor in direct mode, 0 disables it.
+        uint64_t preallocateBytes = 64ull << 20;
+    };
+
+    // Where a Log's records go. Writes from several threads are safe; what they are
+    // ordered by is up to the engine.
+    class IoEngine {
+    public:
+        virtual ~IoEngine() = default;
+
+        virtual const char* name() const noexcept = 0;
+
+        virtual int register_file(std::string_view) = 0;
+        // Extra outputs next to the file. Engines without them say so and return 1.
+        virtual int register_socket(std::string_view path, SocketOptions options = {});
+        virtual int register_pipe(int fd);
+
+        void write(const char* message, size_t len) {
+            struct iovec part = {const_cast<char*>(message), len};
+            writev(&part, 1);
+        }
+        // Gathers the parts into a single write.
+        virtual void writev(const struct iovec*, int) = 0;
+        // Writes the parts without copying them. They must stay valid until the next
+        // submit() of the calling thread returns.
+        virtual void writevBorrowed(const struct iovec*, int) = 0;
+        // Waits for the writes queued so far, by any thread, to complete. False when the
+        // deadline passed first and the engine stopped waiting for some of them.
+        virtual bool submit() = 0;
+        // True once submit() gave up on writes that may still read borrowed parts later on.
+        // Those parts then have to stay valid, and unchanged, for good.
+        virtual bool abandoned() const noexcept { return false; }
+        // Bounds the waits for completions from now on, including those already under way.
+        // Engines that write synchronously have nothing to give up on and ignore it.
+        virtual void setDeadline(std::chrono::steady_clock::time_point) {}
+    };
+
+    // Throws std::runtime_error when the requested engine cannot be set up. Auto falls
+    // back from io_uring to pwritev instead.
+    std::unique_ptr<IoEngine> makeIoEngine(IoOptions const& options = {});
+}
@@ -5,10 +5,29 @@
 #include <iomanip>
 #include <concepts>
 #include <source_location>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <coroutine>
+#include <vector>
+#include <deque>
+#include <span>
 
 #include "log_level.h"
-#include "io_context.h"
-#include "mpmc_queue.h"
+#include "io_engine.h"
+#include "deadline.h"
+#include "queue.h"
+#include "call_site.h"
+#include "backend.h"
+#include "shared_queue.h"
+#include "numa.h"
+#include "format_plan.h"
+#include "site_prefix.h"
+#include "scope.h"
+#include "time_index.h"
+#include "backtrace.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -25,20 +44,60 @@ namespace logging {
 	private:
 		T inner_;
 		std::source_location loc_;
+		FormatPlan plan_;
+		SitePrefix prefix_;
+
+		template<class U>
+		static consteval FormatPlan planOf(U const& inner) {
+			if constexpr (std::is_convertible_v<U const&, std::string_view>) {
+				return FormatPlan(std::string_view(inner));
+			} else {
+				return FormatPlan();
+			}
+		}
 		
 	public:
 		template<class U> requires std::constructible_from<T, U>
 		consteval source_location(U&& inner, std::source_location loc = std::source_location::current()) 
-		: inner_(std::forward<U>(inner)), loc_(std::move(loc)) {}
+		: inner_(std::forward<U>(inner)), loc_(std::move(loc)), plan_(planOf(inner)), prefix_(loc_) {}
 
 		constexpr T const& format() const { return inner_; }
 			
 		constexpr std::source_location const& location() const { return loc_; }
+
+		constexpr FormatPlan const& plan() const { return plan_; }
+
+		constexpr SitePrefix const& prefix() const { return prefix_; }
 	};
 
+	// Stored in a queue right in front of the rendered line.
+	struct Record {
+		// Interned logger, its name is spliced in after prefixSize bytes by the writer.
+		uint16_t logger = 0;
+		uint16_t prefixSize = 0;
+		logging::LogLevel level = logging::LogLevel::debug;
+		// The call site's "basename:line [level] " follows the prefix. site is its hash,
+		// 0 for lines that do not come from a call site and are never collapsed.
+		uint8_t siteSize = 0;
+		uint16_t site = 0;
+		// Nanoseconds since the epoch, as rendered in the prefix. Orders the priority lane
+		// against the other queues.
+		int64_t time = 0;
+	};
+
+	class Logger;
+	class FlushAwaiter;
+
 	class Log {
 	public:
-		Log() = default;
+		Log();
+		explicit Log(IoOptions io);
+		// Hands draining and writing to a background thread configured by options.
+		explicit Log(BackendOptions options, IoOptions io = {});
+		// Logs through a queue in shared memory. Producers only enqueue and need no output,
+		// the one writer drains the queue with a backend configured by options.
+		explicit Log(SharedOptions const& shared, BackendOptions options = {}, IoOptions io = {});
+		// Shuts down without a deadline.
 		~Log(); 
 
 		Log(const Log& other) = delete;
@@ -48,48 +107,367 @@ namespace logging {
 
 		#define _FUNCTION(name) \
 		template<typename... Args> \
-		void name(source_location<fmt::format_string<Args...>> fmt, Args&&... args) { \
-			addLogMessage(logging::LogLevel::name, fmt, std::forward<Args>(args)...); \
-		}
+		void name(source_location<fmt::format_string<Args...>> fmt, Args&&... args);
 		LOGGING_FOR_EACH_LOG_LEVEL(_FUNCTION)
 		#undef _FUNCTION
 
 		void setOutputFile(std::string_view);
 
+		// Forwards every record to a local collector listening on a Unix domain socket,
+		// next to the output file or instead of it.
+		void setOutputSocket(std::string_view path, SocketOptions const& options = {});
+
+		// Feeds every record to the write end of a pipe, e.g. into a compressor process.
+		// Long records are spliced from the queues instead of copied, so the writer waits
+		// for the reader to take them before it reuses the space. The reader has to keep
+		// up: the writer also waits once the pipe is full. The write end is switched to
+		// O_NONBLOCK.
+		void setOutputPipe(int fd);
+
+		// Keeps "<file>.idx" next to the output file, with the first timestamp of every
+		// interval bytes, for log_grep to seek by time. 0 turns it off. Like setOutputFile,
+		// call it before logging.
+		void setTimeIndex(std::size_t interval = 64 << 10);
+
+		// Returns the named logger, creating it and its dot-separated parents on first use.
+		// Loggers share this Log's queue and writer and live as long as it does.
+		Logger& get(std::string_view name);
+
+		Logger& root() { return *loggers_[0]; }
+
+		void setLevel(logging::LogLevel);
+
+		// Names the calling thread in every line it logs, as "<tid>/<name>".
+		static void setThreadName(std::string_view);
+
+		// Adds "key=value" to every line the calling thread logs, through any Log, until
+		// the returned scope is destroyed: `auto request = log.scope("req", id);`.
+		template <typename T>
+		static Scope scope(std::string_view key, T const& value) {
+			return Scope(key, value);
+		}
+
+		// Applies to every call site of this Log separately; suppressed messages are never
+		// formatted. A site's "suppressed N messages" line is written when it logs again
+		// after the summary interval, or by the writer within about 100 ms of the interval
+		// if it does not. May be changed while other threads log.
+		void setRateLimit(RateLimit const&);
+
+		// The writer drops lines identical to the previous one of the same call site and
+		// writes "repeated N times" at the end of the run. A run lasts at most window,
+		// the next identical line after that is written and starts a new one. Nothing is
+		// collapsed with a zero window. May be changed while other threads log, runs in
+		// progress keep going until they end under the new window.
+		void setRepeatWindow(std::chrono::milliseconds window);
+
+		// Keeps the last depth records each thread logs below its logger's threshold, with
+		// their arguments unformatted, and writes them out ahead of the thread's next error
+		// or fatal line. Only numbers and strings are kept as they are, messages with other
+		// arguments are formatted when captured. 0 turns it off.
+		void setBacktrace(std::size_t depth);
+
+		// Resolves once every record enqueued before the call has its write completion.
+		// Without a backend the calling thread writes the queue out and gets a ready future.
+		std::future<void> flush();
+
+		// Same as flush() for coroutines, `co_await log.flushAsync()`. With a backend the
+		// coroutine is resumed on a thread of this Log that resumes flushed coroutines one
+		// after the other, so it should hop off it before heavy work. Without one it does not
+		// suspend.
+		FlushAwaiter flushAsync();
+
+		// Stops the backend and writes out what is queued, giving up at the deadline.
+		// Returns how many records were not persisted: those still queued then, and those
+		// whose writes had not completed. Records logged afterwards are dropped. A shared
+		// producer only stops, its records are the writer's to persist; it returns how many
+		// it dropped because the shared queue stayed full or the writer was gone.
+		std::size_t shutdown(std::chrono::steady_clock::time_point deadline);
+
 	private:
-		template <typename... Args>
-		void addLogMessage(logging::LogLevel level, source_location<fmt::format_string<Args...>> fmt, Args&&... args) {
-			std::string now = getPrefix();
+		friend class Logger;
+		friend class FlushAwaiter;
+
+		// Write tickets of every queue at the time of the flush call, the priority lane last.
+		using FlushTargets = std::vector<uint64_t>;
+
+		struct FlushWaiter {
+			FlushTargets targets;
+			std::promise<void> promise;
+			std::coroutine_handle<> handle;
+		};
 
+		// Lines of one call site, or of several whose hashes share the slot, that were
+		// identical to the run's first line.
+		struct RepeatRun {
+			// The first line as queued, record and text.
+			std::string line;
+			uint64_t repeats = 0;
+			int64_t last = 0;
+		};
+
+		static constexpr std::size_t kMaxLoggers = 1024;
+		static constexpr std::size_t kQueueCapacity = 1 << 20;
+		static constexpr std::size_t kPriorityCapacity = 64 << 10;
+		static constexpr std::size_t kRepeatSlots = 4096;
+		// Nanoseconds between two sweeps of the writer for suppressed summaries.
+		static constexpr int64_t kSummarySweepInterval = 100'000'000;
+		// "YYYY-MM-DD HH:MM:SS.nnnnnnnnn " at the start of every line.
+		static constexpr std::size_t kTimeSize = 30;
+
+		template <typename... Args>
+		void addLogMessage(uint16_t logger, logging::LogLevel level, source_location<fmt::format_string<Args...>> fmt, Args&&... args) {
 			auto const& loc = fmt.location();
 
-			auto log_msg = fmt::vformat(to_string_view(fmt.format()), fmt::make_format_args(args...));
+			if (RateLimit limit = rate_limit_.load(); limit.enabled()) {
+				CallSite& site = call_sites_.of(loc);
+				if (!site.admit(limit)) {
+					return;
+				}
+				if (auto suppressed = site.takeSuppressed(limit)) {
+					addSuppressedSummary(logger, level, site, suppressed);
+				}
+			}
 
-			auto output_msg = fmt::format("{} {}:{} [{}] {}\n", now, loc.file_name(), loc.line(), logLevelToString(level), log_msg);
+			if (level >= LogLevel::error && backtraceEnabled()) {
+				dumpBacktrace();
+			}
 
-			auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(250);
+			// The whole line is rendered in one pass into a buffer reused by this thread.
+			fmt::memory_buffer& buffer = threadBuffer();
+			buffer.clear();
+			auto time = appendPrefix(buffer);
+			auto prefix_size = buffer.size();
+			if (!fmt.prefix().appendTo(buffer, level)) {
+				appendSite(buffer, loc, level);
+			}
+			auto site_size = buffer.size() - prefix_size;
+			if (auto fields = Scope::fields(); !fields.empty()) {
+				buffer.append(fields.data(), fields.data() + fields.size());
+			}
+			auto format = to_string_view(fmt.format());
+			if (fmt.plan().matches(sizeof...(Args))) {
+				fmt.plan().formatTo(buffer, std::string_view(format.data(), format.size()), args...);
+			} else {
+				fmt::vformat_to(std::back_inserter(buffer), format, fmt::make_format_args(args...));
+			}
+			buffer.push_back('\n');
 
-			mpmc_.write(std::move(output_msg));
+			Record record{logger, static_cast<uint16_t>(prefix_size), level, static_cast<uint8_t>(site_size), fmt.prefix().site(), time};
+			enqueue(record, {buffer.data(), buffer.size()});
+		}
 
-			std::string pop_msg{};
-			while (mpmc_.size() >= mpmc_.capacity() / 2) {
-				mpmc_.read(pop_msg);
+		bool backtraceEnabled() const noexcept {
+			return backtrace_depth_.load(std::memory_order_relaxed) != 0;
+		}
 
-				io_context_.write(pop_msg.data(), pop_msg.size());
-			} 
+		template <typename... Args>
+		void captureBacktrace(uint16_t logger, logging::LogLevel level, source_location<fmt::format_string<Args...>> const& fmt, Args&&... args) {
+			std::size_t depth = backtrace_depth_.load(std::memory_order_relaxed);
+			BacktraceRing& ring = backtraceRing();
+			if (!ring.ownedBy(id_, depth)) {
+				ring.reset(id_, depth);
+			}
+
+			BacktraceSlot& slot = ring.next();
+			auto format = to_string_view(fmt.format());
+			slot.formatString = std::string_view(format.data(), format.size());
+			slot.loc = fmt.location();
+			slot.time = now();
+			slot.logger = logger;
+			slot.level = level;
+			slot.capture(args...);
 		}
 
+		void dumpBacktrace();
+		static BacktraceRing& backtraceRing();
+
+		void enqueue(Record const&, std::string_view text);
+		Queue& localQueue();
+		FlushTargets flushTargets() const;
+		bool registerFlush(FlushTargets, std::promise<void>*, std::coroutine_handle<>);
+		bool flushed(FlushTargets const&) const;
+		void completeFlushes(bool all);
+		void resumeFlushed();
+		bool drain();
+		std::size_t discardQueued();
+		void writeRecord(std::span<char>);
+		bool collapseRepeat(std::span<char>);
+		void writeRepeats(RepeatRun&);
+		std::size_t flushRepeats(bool all);
+		void addSuppressedSummary(uint16_t, logging::LogLevel, CallSite&, uint64_t);
+		Record renderSummary(fmt::memory_buffer&, uint16_t, logging::LogLevel, CallSite&, uint64_t);
+		std::size_t writeSummaries(RateLimit const&);
+		void updateLevels();
+
 		template <typename T, typename... Args>
 		fmt::basic_string_view<T> to_string_view(fmt::basic_format_string<T, Args...> fmt) {
 			return fmt;
 		}
 		
-		std::string getPrefix();
-		std::string logLevelToString(logging::LogLevel);
+		static fmt::memory_buffer& threadBuffer();
+		// Returns the rendered time in nanoseconds since the epoch.
+		int64_t appendPrefix(fmt::memory_buffer&);
+		void appendPrefix(fmt::memory_buffer&, int64_t time);
+		static void appendTime(fmt::memory_buffer&, int64_t time);
+		static int64_t now() noexcept;
 
 	private:
-		logging::IoContext io_context_;
-		std::string_view file_path_;
-		MPMCQueue<std::string> mpmc_{100};
+		// A shared producer has no engine.
+		Log(std::unique_ptr<IoEngine> io, MemoryOptions const& memory);
+		bool hasOutputs() const;
+
+		// Counts a call in in_flight_ for its lifetime. Taken before closed_ is checked, so
+		// either shutdown sees the call or the call sees closed_.
+		struct InFlight {
+			explicit InFlight(Log& log) : log_(log) { log_.in_flight_.fetch_add(1); }
+			~InFlight() { log_.in_flight_.fetch_sub(1, std::memory_order_release); }
+			Log& log_;
+		};
+
+		// Tells this Log's per-thread state apart from that of an earlier Log at the same address.
+		const uint64_t id_;
+		std::unique_ptr<IoEngine> io_;
+		std::string file_path_;
+		// One staging queue per NUMA node, allocated on that node. Producers use the queue of
+		// the node they first logged from, the writer drains all of them.
+		std::vector<std::unique_ptr<Queue>> queues_;
+		// Error and fatal records skip the queues above, so a backlog of debug records can
+		// neither delay nor drop them. The writer empties this lane on every pass.
+		std::unique_ptr<Queue> priority_;
+		// Shared mode: a producer's records all go here, a writer drains it as well.
+		std::unique_ptr<SharedQueue> shared_;
+		bool producer_ = false;
+		// Set before the backend starts and never changed, unlike backend_ itself.
+		bool threaded_ = false;
+		bool shut_down_ = false;
+		std::atomic<bool> closed_{false};
+		// Calls that may use the backend, shutdown waits for them before destroying it.
+		std::atomic<uint32_t> in_flight_{0};
+		// Set by shutdown, drain passes stop once it has passed.
+		Deadline deadline_;
+
+		// Writer state. Without a backend, producers take turns under drain_mutex_.
+		std::mutex drain_mutex_;
+		std::vector<std::span<char>> queued_;
+		std::vector<std::span<char>> urgent_;
+		std::vector<struct iovec> iovecs_;
+		// Records of passes whose writes failed or were given up on at the deadline.
+		std::size_t unpersisted_ = 0;
+		// The engine gave up on writes that may still read a pass's parts, which are then
+		// never released, and the writer stops.
+		bool abandoned_ = false;
+		// Nanoseconds, set from any thread while the writer reads it.
+		std::atomic<int64_t> repeat_window_{0};
+		// Allocated up front, so a window set while the writer runs has its slots ready.
+		std::vector<RepeatRun> repeat_runs_ = std::vector<RepeatRun>(kRepeatSlots);
+		// Slots with repeats not written yet.
+		std::vector<std::size_t> repeating_;
+		// "repeated N times" and "suppressed N messages" lines of the current pass, a deque
+		// so they stay in place.
+		std::deque<std::string> repeat_lines_;
+		int64_t next_summary_sweep_ = 0;
+		std::size_t index_interval_ = 0;
+		std::unique_ptr<TimeIndex> index_;
+		AtomicRateLimit rate_limit_;
+		CallSiteTable call_sites_;
+		std::atomic<std::size_t> backtrace_depth_{0};
+
+		// Slots are filled under loggers_mutex_ and never change afterwards, so the writer
+		// can look a logger up by the id carried in a record without locking.
+		std::mutex loggers_mutex_;
+		std::unique_ptr<Logger> loggers_[kMaxLoggers];
+		uint16_t logger_count_ = 0;
+
+		std::mutex flush_mutex_;
+		std::vector<FlushWaiter> flush_waiters_;
+		std::atomic<uint32_t> flush_pending_{0};
+		// Coroutines whose flush completed, resumed by resumer_, which starts with the first
+		// coroutine that waits.
+		std::vector<std::coroutine_handle<>> resumable_;
+		std::condition_variable resume_cv_;
+		bool resumer_stop_ = false;
+		std::thread resumer_;
+
+		std::unique_ptr<Backend> backend_;
+	};
+
+	class FlushAwaiter {
+	public:
+		bool await_ready() const noexcept { return false; }
+
+		bool await_suspend(std::coroutine_handle<> handle) {
+			return log_.registerFlush(std::move(targets_), nullptr, handle);
+		}
+
+		void await_resume() const noexcept {}
+
+	private:
+		friend class Log;
+
+		FlushAwaiter(Log& log, Log::FlushTargets targets) : log_(log), targets_(std::move(targets)) {}
+
+		Log& log_;
+		Log::FlushTargets targets_;
+	};
+
+	// Lightweight named front-end of a Log. Its threshold is either set explicitly or
+	// inherited from the closest ancestor that has one, and is read without locking.
+	class Logger {
+	public:
+		Logger(const Logger&) = delete;
+		Logger& operator=(const Logger&) = delete;
+
+		#define _FUNCTION(name) \
+		template<typename... Args> \
+		void name(source_location<fmt::format_string<Args...>> fmt, Args&&... args) { \
+			if (enabled(logging::LogLevel::name)) { \
+				log_.addLogMessage(id_, logging::LogLevel::name, fmt, std::forward<Args>(args)...); \
+			} else if (log_.backtraceEnabled()) { \
+				log_.captureBacktrace(id_, logging::LogLevel::name, fmt, std::forward<Args>(args)...); \
+			} \
+		}
+		LOGGING_FOR_EACH_LOG_LEVEL(_FUNCTION)
+		#undef _FUNCTION
+
+		bool enabled(logging::LogLevel level) const noexcept {
+			return level >= level_.load(std::memory_order_relaxed);
+		}
+
+		// Sets the threshold of this logger and of every descendant without its own.
+		void setLevel(logging::LogLevel);
+		// Goes back to inheriting the threshold from the parent.
+		void resetLevel();
+
+		logging::LogLevel level() const noexcept { return level_.load(std::memory_order_relaxed); }
+		std::string_view name() const noexcept { return std::string_view(tag_).substr(0, name_size_); }
+		uint16_t id() const noexcept { return id_; }
+
+	private:
+		friend class Log;
+
+		Logger(Log& log, uint16_t id, Logger* parent, std::string_view name)
+			: log_(log), id_(id), parent_(parent), tag_(name), name_size_(name.size()) {
+			if (!tag_.empty()) {
+				tag_.push_back(' ');
+			}
+		}
+
+		Log& log_;
+		uint16_t id_;
+		Logger* parent_;
+		// The name followed by a space, as spliced into output lines.
+		std::string tag_;
+		std::size_t name_size_;
+		bool explicit_level_ = false;
+		logging::LogLevel own_level_ = logging::LogLevel::debug;
+		std::atomic<logging::LogLevel> level_{logging::LogLevel::debug};
 	};
+
+	#define _FUNCTION(name) \
+	template<typename... Args> \
+	void Log::name(source_location<fmt::format_string<Args...>> fmt, Args&&... args) { \
+		root().name(fmt, std::forward<Args>(args)...); \
+	}
+	LOGGING_FOR_EACH_LOG_LEVEL(_FUNCTION)
+	#undef _FUNCTION
 }
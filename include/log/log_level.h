@@ -1,3 +1,7 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
 namespace logging {
 
 #define LOGGING_FOR_EACH_LOG_LEVEL(f) \
@@ -12,4 +16,22 @@ enum class LogLevel : std::uint8_t {
 #undef _FUNCTION
 };
 
+inline constexpr std::string_view kLogLevelNames[] = {
+#define _FUNCTION(name) #name,
+	LOGGING_FOR_EACH_LOG_LEVEL(_FUNCTION)
+#undef _FUNCTION
+};
+
+// The level as it appears in a line, "[info] ".
+inline constexpr std::string_view kLogLevelTags[] = {
+#define _FUNCTION(name) "[" #name "] ",
+	LOGGING_FOR_EACH_LOG_LEVEL(_FUNCTION)
+#undef _FUNCTION
+};
+
+constexpr std::string_view logLevelToString(LogLevel level) {
+	auto idx = static_cast<std::size_t>(level);
+	return idx < std::size(kLogLevelNames) ? kLogLevelNames[idx] : std::string_view{"UNKNOWN"};
 }
+
+}
\ No newline at end of file
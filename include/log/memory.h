@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace logging {
+    enum class HugePages : uint8_t {
+        None,
+        // Asks for transparent huge pages with madvise, on a 2 MiB aligned region.
+        Transparent,
+        // Reserved hugetlbfs pages (MAP_HUGETLB), Transparent when none are free.
+        Explicit,
+    };
+
+    struct MemoryOptions {
+        // NUMA node the pages should live on, -1 leaves placement to the first touch.
+        int node = -1;
+        // Huge page backed allocations are rounded up to whole 2 MiB pages.
+        HugePages hugePages = HugePages::None;
+        // Faults every page in at allocation, so the first burst takes no page faults.
+        bool prefault = false;
+        // Also mlocks the pages. A failure, e.g. from RLIMIT_MEMLOCK, is reported and ignored.
+        bool lock = false;
+    };
+
+    // Page-granular allocations for queue slots and I/O buffers. Throws std::bad_alloc.
+    void* allocatePages(std::size_t bytes, MemoryOptions const& options = {});
+    // Takes the options the pages were allocated with.
+    void freePages(void* ptr, std::size_t bytes, MemoryOptions const& options = {}) noexcept;
+}
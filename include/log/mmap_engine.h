@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "io_engine.h"
+
+namespace logging {
+    // Copies records into a shared mapping of a window of the file and leaves writing
+    // them back to the page cache, so logging costs a memcpy and one ftruncate per call,
+    // which moves the end of the file to the last record. Windows are allocated with
+    // fallocate before they are mapped, so a full disk fails the allocation instead of
+    // faulting a store. Readers of a live file see the records written so far and
+    // nothing past them; the allocation beyond the end is released on close. A file left
+    // with zeros past its last record by an older writer is cut back on the next open.
+    // Only one process may write the file at a time, its end is this engine's to move.
+    class MmapEngine : public IoEngine {
+    public:
+        static constexpr std::size_t kWindowSize = 64 << 20;
+        static constexpr std::size_t kBlockSize = 4096;
+
+        MmapEngine() = default;
+
+        MmapEngine(const MmapEngine&) = delete;
+        MmapEngine& operator=(const MmapEngine&) = delete;
+
+        ~MmapEngine() override;
+
+        const char* name() const noexcept override { return "mmap"; }
+
+        int register_file(std::string_view) override;
+        void writev(const struct iovec*, int) override;
+        void writevBorrowed(const struct iovec*, int) override;
+        // Stores are visible to readers as soon as they are made. False if records were
+        // lost since the last call because the file could not be extended or mapped.
+        bool submit() override;
+
+    private:
+        bool map(uint64_t offset);
+        void unmap();
+
+        std::mutex mutex_;
+        int fd_ = -1;
+        char* window_ = nullptr;
+        bool failed_ = false;
+        // File offset of the window and of the next byte to write.
+        uint64_t base_ = 0;
+        uint64_t size_ = 0;
+        // End of the last window mapped, up to which blocks may be reserved.
+        uint64_t window_end_ = 0;
+    };
+}
@@ -1,7 +1,10 @@
 #include <new>
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
 
 #include "turn_sequencer.h"
+#include "memory.h"
 
 template <typename T, template <typename> class Atom>
 struct SingleElementQueue;
@@ -14,9 +17,13 @@ class MPMCQueue : public MPMCQueueBase<MPMCQueue<T, Atom, Dynamic>> {
     using Slot = SingleElementQueue<T, Atom>;
 
 public:
-    explicit MPMCQueue(size_t queueCapacity) : MPMCQueueBase<MPMCQueue<T, Atom, Dynamic>>(queueCapacity) {
+    explicit MPMCQueue(size_t queueCapacity, logging::MemoryOptions const& memory = {}) : MPMCQueueBase<MPMCQueue<T, Atom, Dynamic>>(queueCapacity) {
         this->stride_ = this->computeStride(queueCapacity);
-        this->slots_ = new Slot[queueCapacity + 2 * this->kSlotPadding];
+        this->memory_ = memory;
+        this->slots_ = static_cast<Slot*>(logging::allocatePages(this->slotsBytes(), memory));
+        for (size_t i = 0; i < this->slotCount(); ++i) {
+            new (&this->slots_[i]) Slot();
+        }
     }
 
     MPMCQueue() noexcept {}
@@ -52,7 +59,14 @@ public:
     MPMCQueueBase(const MPMCQueueBase&) = delete;
     MPMCQueueBase& operator=(const MPMCQueueBase&) = delete;
 
-    ~MPMCQueueBase() { delete[] slots_; }
+    ~MPMCQueueBase() {
+        if (slots_) {
+            for (size_t i = 0; i < slotCount(); ++i) {
+                slots_[i].~Slot();
+            }
+            logging::freePages(slots_, slotsBytes(), memory_);
+        }
+    }
 
     ssize_t size() const noexcept {
         uint64_t pushes = pushTicket_.load(std::memory_order_acquire);
@@ -200,7 +214,9 @@ protected:
 
     alignas(hardware_destructive_interference_size) size_t capacity_;
 
-    Slot* slots_;
+    Slot* slots_ = nullptr;
+
+    logging::MemoryOptions memory_{};
 
     int stride_;
 
@@ -214,6 +230,10 @@ protected:
 
     char pad_[hardware_destructive_interference_size - sizeof(Atom<uint32_t>)];
 
+    size_t slotCount() const noexcept { return capacity_ + 2 * kSlotPadding; }
+
+    size_t slotsBytes() const noexcept { return slotCount() * sizeof(Slot); }
+
     static int computeStride(size_t capacity) noexcept {
         static const int smallPrimes[] = {2, 3, 5, 7, 11, 13, 17, 19, 23};
 
@@ -319,11 +339,11 @@ protected:
     bool tryObtainPromisedPopTicketUntil(uint64_t& ticket, Slot*& slots, size_t& cap, int& stride, const std::chrono::time_point<Clock>& when) noexcept {
         bool deadlineReached = false;
         while (!deadlineReached) {
-            if (static_cast<Derived<T, Atom, Dynamic>>(this)->tryObtainPromisedPopTicket(ticket, slots, cap, stride)) {
+            if (static_cast<Derived<T, Atom, Dynamic>*>(this)->tryObtainPromisedPopTicket(ticket, slots, cap, stride)) {
                 return true;
             }
 
-            deadlineReached = !slots[idx(ticket, cap, stride)].tryWaitForDequeueTurnUntil(turn(ticket, cap), pushSpinCutoff_, 
+            deadlineReached = !slots[idx(ticket, cap, stride)].tryWaitForDequeueTurnUntil(turn(ticket, cap), popSpinCutoff_, 
             (ticket % kAdaptationFreq) == 0, when);
         }
         return false;
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace logging {
+    // NUMA layout of the machine as exposed in /sys/devices/system/node. Machines without
+    // that directory, or with a single node, are reported as one node covering every CPU.
+    class NumaTopology {
+    public:
+        static NumaTopology const& get();
+
+        std::size_t nodeCount() const noexcept { return nodes_.size(); }
+
+        // Node ids are not necessarily dense, index i maps to nodes()[i].
+        std::vector<int> const& nodes() const noexcept { return nodes_; }
+
+        // Index into nodes() of the node the calling thread runs on right now.
+        std::size_t currentIndex() const noexcept;
+
+    private:
+        NumaTopology();
+
+        std::vector<int> nodes_;
+        std::vector<int> cpu_to_index_;
+    };
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/uio.h>
+
+#include "deadline.h"
+
+namespace logging {
+    // Feeds records to a pipe read by another process, e.g. a compressor or shipper.
+    // Borrowed parts are handed over with vmsplice, the pipe then references their pages
+    // and nothing is copied until the reader reads them. Short parts are still copied with
+    // writev, as each spliced part takes a pipe slot of its own. The write end is switched
+    // to O_NONBLOCK, so a writer waiting for the reader gives up at the deadline and drops
+    // the rest. Once the reader is gone everything is dropped.
+    // Not thread-safe, the owner serializes calls.
+    class PipeSink {
+    public:
+        // The default limit of F_SETPIPE_SZ for unprivileged processes.
+        static constexpr size_t kPipeSize = 1024 * 1024;
+        // Parts shorter than this are copied rather than spliced.
+        static constexpr size_t kSpliceMin = 2048;
+
+        PipeSink(int fd, Deadline const& deadline);
+
+        PipeSink(const PipeSink&) = delete;
+        PipeSink& operator=(const PipeSink&) = delete;
+
+        // Reports what was dropped. What is in the pipe is the reader's, nothing is waited for.
+        ~PipeSink();
+
+        // Copies the parts into the pipe. Blocks only while the pipe is full.
+        void write(const struct iovec*, int);
+        // Like write, but long parts are spliced and must not change before consumed()
+        // returned true.
+        void splice(const struct iovec*, int);
+        // Waits for the reader to take everything spliced so far. False once the deadline
+        // passed first: the reader may still read the spliced pages at any later time.
+        bool consumed();
+
+        bool abandoned() const noexcept { return abandoned_; }
+
+    private:
+        void send(const struct iovec*, int, bool by_reference);
+        bool waitWritable();
+
+        int fd_;
+        Deadline const& deadline_;
+        bool broken_ = false;
+        bool abandoned_ = false;
+        // Bytes that went into the pipe, and how many of them did when the last part was spliced.
+        uint64_t written_ = 0;
+        uint64_t spliced_ = 0;
+        uint64_t dropped_ = 0;
+    };
+}
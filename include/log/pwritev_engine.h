@@ -0,0 +1,33 @@
+#pragma once
+#include <mutex>
+
+#include "io_engine.h"
+
+namespace logging {
+    // Plain writev(2) to the file opened with O_APPEND, one writer at a time, so every
+    // call lands at the end even while other processes append to it. The Log's backend
+    // is already the dedicated thread that calls it, so writes complete before they
+    // return and submit() has nothing left to wait for. Needs no io_uring.
+    class PwritevEngine : public IoEngine {
+    public:
+        PwritevEngine() = default;
+
+        PwritevEngine(const PwritevEngine&) = delete;
+        PwritevEngine& operator=(const PwritevEngine&) = delete;
+
+        ~PwritevEngine() override;
+
+        const char* name() const noexcept override { return "pwritev"; }
+
+        int register_file(std::string_view) override;
+        void writev(const struct iovec*, int) override;
+        void writevBorrowed(const struct iovec*, int) override;
+        // Writes completed before they returned, false if one of them failed since the last call.
+        bool submit() override;
+
+    private:
+        std::mutex mutex_;
+        int fd_ = -1;
+        bool failed_ = false;
+    };
+}
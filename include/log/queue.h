@@ -1,120 +1,229 @@
-#include <memory>
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <span>
+#include <stdexcept>
+
+#include "memory.h"
 
 namespace logging {
-	template<typename T, typename Alloc = std::allocator<T>>
-	class Queue : private Alloc {
-	public: 
-		using value_type = T;
-		using allocator_traits = std::allocator_traits<Alloc>;
-		using size_type = typename allocator_traits::size_type;
-
-		Queue(Alloc const& alloc = Alloc{})
-			: Alloc{alloc}
-			, capacity_{0}
-			, ring_{allocator_traits::allocate(*this, capacity_)}
-		{}
+	// Producer and consumer positions of a Queue. Kept apart from it, so a ring in memory
+	// shared between processes can carry its positions along.
+	struct QueueControl {
+		alignas(64) std::atomic<uint64_t> tail{0};
+		alignas(64) std::atomic<uint64_t> head{0};
+	};
 
-		explicit Queue(size_type capacity, Alloc const& alloc = Alloc{})
-			: Alloc{alloc}
-			, capacity_{capacity}
-			, ring_{allocator_traits::allocate(*this, capacity)}
+	// Bounded lock-free ring of variable-size records for many producers and one consumer.
+	// Producers reserve space with a CAS on the tail, fill it in place and commit it by
+	// publishing the record's header. The consumer reads committed records in reservation
+	// order straight out of the ring and releases them in bulk once it is done with them,
+	// so memory is bounded in bytes and records are densely packed.
+	class Queue {
+	public:
+		// Capacity is rounded up to a power of two.
+		explicit Queue(std::size_t capacity, MemoryOptions const& memory = {})
+			: capacity_{roundUp(capacity)}
+			, mask_{capacity_ - 1}
+			, ring_{static_cast<char*>(allocatePages(capacity_, memory))}
+			, memory_{memory}
+			, control_{own_}
+			, owned_{true}
 		{}
 
+		// A view of a zeroed ring of capacity bytes, a power of two, and its positions that
+		// live elsewhere, e.g. in shared memory. At most one view may read.
+		Queue(QueueControl& control, char* ring, std::size_t capacity)
+			: capacity_{roundUp(capacity)}
+			, mask_{capacity_ - 1}
+			, ring_{ring}
+			, control_{control}
+			, owned_{false}
+			, read_{control.head.load(std::memory_order_acquire)}
+		{
+			if (capacity_ != capacity) {
+				throw std::invalid_argument("Queue capacity must be a power of two");
+			}
+		}
+
 		~Queue() {
-			allocator_traits::deallocate(*this, ring_, capacity_);
+			if (owned_) {
+				freePages(ring_, capacity_, memory_);
+			}
 		}
-		
-		auto size() const noexcept {
-			return pushCursor_ - popCursor_;
+
+		Queue(const Queue&) = delete;
+		Queue& operator=(const Queue&) = delete;
+
+		std::size_t capacity() const noexcept {
+			return capacity_;
 		}
 
-		auto empty() const noexcept {
-			return size() == 0;
+		// Largest payload a single reservation may ask for.
+		std::size_t maxRecordSize() const noexcept {
+			return capacity_ / 2 - kHeaderSize;
 		}
 
-		auto full() const noexcept {
-			return size() == capacity();
+		// Bytes reserved and not yet released, padding included.
+		std::size_t size() const noexcept {
+			return control_.tail.load(std::memory_order_acquire) - control_.head.load(std::memory_order_acquire);
 		}
 
-		auto capacity() const noexcept {
-			return capacity_;
+		// Total bytes ever reserved and released. A record reserved before writePosition()
+		// returned p is released once releasePosition() >= p.
+		uint64_t writePosition() const noexcept {
+			return control_.tail.load(std::memory_order_acquire);
 		}
 
-		void push(T* value, size_type len) {
-			if (full(pushCursor_, popCursor_)) {
-				return;
+		uint64_t releasePosition() const noexcept {
+			return control_.head.load(std::memory_order_acquire);
+		}
+
+		// Returns size writable bytes, 8-byte aligned, or nullptr when the ring is too full
+		// right now. Nothing is visible to the consumer until commit(). A nonzero owner, e.g.
+		// a process id, is kept with the reservation until then, so the consumer can skip it
+		// with skipAbandoned() should the owner die first.
+		char* tryReserve(std::size_t size, uint32_t owner = 0) noexcept {
+			if (size > maxRecordSize()) {
+				return nullptr;
 			}
+			const uint64_t need = align(kHeaderSize + size);
+
+			uint64_t tail = control_.tail.load(std::memory_order_relaxed);
+			uint64_t pad;
+			do {
+				// A record never wraps, the space left before the end becomes padding instead.
+				const uint64_t left = capacity_ - (tail & mask_);
+				pad = left < need ? left : 0;
+				if (tail + pad + need - control_.head.load(std::memory_order_acquire) > capacity_) {
+					return nullptr;
+				}
+			} while (!control_.tail.compare_exchange_weak(tail, tail + pad + need, std::memory_order_relaxed));
 
-			auto div_pushCursor  = pushCursor_ % capacity_;
-			std::size_t len_to_add = capacity_ - div_pushCursor;
-			if (len > len_to_add) {
-				memcpy(element(pushCursor_), value, len_to_add);
-				memcpy(element(0), value + len_to_add, len - len_to_add);
-			} else {
-				memcpy(element(pushCursor_), value, len);
+			if (pad != 0) {
+				header(tail).store(static_cast<uint32_t>(pad) | kPadding, std::memory_order_release);
+				tail += pad;
+			}
+			if (owner != 0) {
+				ownerOf(tail).store(owner, std::memory_order_relaxed);
+				header(tail).store(kPending | static_cast<uint32_t>(need / kHeaderSize), std::memory_order_release);
+			}
+			return ring_ + (tail & mask_) + kHeaderSize;
+		}
+
+		// Publishes a reservation of size bytes, the same size that was reserved.
+		void commit(char* record, std::size_t size) noexcept {
+			headerOf(record).store(static_cast<uint32_t>(size) + 1, std::memory_order_release);
+		}
+
+		// Next committed record, empty when the ring is drained or the oldest reservation is
+		// still being filled. Records stay valid until release().
+		std::span<char> read() noexcept {
+			// A full ring wraps around onto records read in this pass but not released yet.
+			while (read_ - control_.head.load(std::memory_order_relaxed) < capacity_) {
+				const uint32_t word = header(read_).load(std::memory_order_acquire);
+				if (word == 0 || (word & kPending)) {
+					return {};
+				}
+				if (word & kPadding) {
+					read_ += word & ~kPadding;
+					continue;
+				}
+
+				char* record = ring_ + (read_ & mask_) + kHeaderSize;
+				read_ += align(kHeaderSize + word - 1);
+				return {record, word - 1};
 			}
+			return {};
+		}
 
-			pushCursor_ += len;
-			return;
+		// Whether read() has handed out everything reserved so far, rather than stopping at
+		// a reservation still being filled or at records not released yet.
+		bool caughtUp() const noexcept {
+			return read_ == control_.tail.load(std::memory_order_acquire);
 		}
 
-		void pop(T* value) {
-			if (empty(pushCursor_, popCursor_)) {
+		// Steps over the reservation read() stopped at if it was made with an owner for which
+		// abandoned(owner) holds, so a producer that died before committing does not stall
+		// the ring for good. Its space is released along with the records read. True if one
+		// was skipped.
+		template <typename Abandoned>
+		bool skipAbandoned(Abandoned&& abandoned) {
+			if (read_ - control_.head.load(std::memory_order_relaxed) >= capacity_) {
+				return false;
+			}
+			const uint32_t word = header(read_).load(std::memory_order_acquire);
+			if (!(word & kPending) || !abandoned(ownerOf(read_).load(std::memory_order_relaxed))) {
+				return false;
+			}
+			read_ += uint64_t{word & ~kPending} * kHeaderSize;
+			return true;
+		}
+
+		// Hands every record returned by read() back to the producers.
+		void release() noexcept {
+			const uint64_t head = control_.head.load(std::memory_order_relaxed);
+			if (read_ == head) {
 				return;
 			}
 
-			if (pushCursor_ < capacity_) {
-				memcpy(value, element(popCursor_), pushCursor_ - popCursor_);
-				memset(element(popCursor_), '0', pushCursor_ - popCursor_);
-				popCursor_ += (pushCursor_ - popCursor_);
+			// Reservations only ever look at zeroed headers, whatever the old layout was.
+			const std::size_t from = head & mask_;
+			const std::size_t len = read_ - head;
+			if (from + len > capacity_) {
+				memset(ring_ + from, 0, capacity_ - from);
+				memset(ring_, 0, len - (capacity_ - from));
 			} else {
-				auto real_push = (popCursor_ > capacity_) ? pushCursor_ % capacity_ : pushCursor_;
-				auto real_pop = popCursor_ % capacity_;
-               			std::size_t len_to_add = (real_push > real_pop) ? real_push - real_pop : (capacity_ - real_pop + real_push);
-
-				if (real_pop + len_to_add > capacity_) {
-					memcpy(value, element(popCursor_), capacity_ - real_pop);
-					memcpy(value + (capacity_ - real_pop), element(popCursor_ + capacity_ - (real_pop)), len_to_add - (capacity_ - (real_pop)));
-					memset(element(popCursor_), '0', capacity_ - real_pop);
-					memset(element(popCursor_ + capacity_ - real_pop), '0', len_to_add - (capacity_ - real_pop));
-				} else {
-					memcpy(value, element(popCursor_), len_to_add);
-					memset(element(popCursor_), '0', len_to_add);
-				}
-				
-				popCursor_ += len_to_add;
+				memset(ring_ + from, 0, len);
 			}
-			return;
-		}
-		
-		T* flush() {
-			T* pop_ptr = new T[size()];
-			pop(pop_ptr);
-			return pop_ptr;
+			control_.head.store(read_, std::memory_order_release);
 		}
-			
+
 	private:
-		auto full(size_type pushCursor, size_type popCursor) const noexcept {
-			return (pushCursor - popCursor) == capacity_;
+		static constexpr std::size_t kHeaderSize = 8;
+		static constexpr uint32_t kPadding = 1u << 31;
+		// Reserved with an owner and not committed yet, the length is kept in header units.
+		static constexpr uint32_t kPending = 1u << 30;
+
+		static constexpr uint64_t align(uint64_t size) noexcept {
+			return (size + kHeaderSize - 1) & ~uint64_t{kHeaderSize - 1};
 		}
 
-		static auto empty(size_type pushCursor, size_type popCursor) noexcept {
-			return pushCursor == popCursor;
+		static std::size_t roundUp(std::size_t capacity) {
+			if (capacity < 64 || capacity > (std::size_t{1} << 31)) {
+				throw std::invalid_argument("Queue capacity must be between 64 bytes and 2 GiB");
+			}
+			std::size_t rounded = 64;
+			while (rounded < capacity) {
+				rounded <<= 1;
+			}
+			return rounded;
 		}
 
-		auto element(size_type cursor) noexcept {
-			return &ring_[cursor % capacity_];
+		std::atomic<uint32_t>& header(uint64_t position) noexcept {
+			return *reinterpret_cast<std::atomic<uint32_t>*>(ring_ + (position & mask_));
 		}
 
-	private:
-		size_type capacity_;
-		T* ring_;
+		// The header's second word, unused once the record is committed.
+		std::atomic<uint32_t>& ownerOf(uint64_t position) noexcept {
+			return *reinterpret_cast<std::atomic<uint32_t>*>(ring_ + (position & mask_) + sizeof(uint32_t));
+		}
+
+		static std::atomic<uint32_t>& headerOf(char* record) noexcept {
+			return *reinterpret_cast<std::atomic<uint32_t>*>(record - kHeaderSize);
+		}
 
-		size_type pushCursor_{0};
-		size_type popCursor_{0};
+		const std::size_t capacity_;
+		const std::size_t mask_;
+		char* const ring_;
+		const MemoryOptions memory_{};
+
+		QueueControl own_;
+		QueueControl& control_;
+		const bool owned_;
+		// Consumer side: records before read_ have been handed out, before head released.
+		uint64_t read_ = 0;
 	};
 }
-					
-
-				
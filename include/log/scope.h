@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+#include <fmt/format.h>
+
+namespace logging {
+    // Adds "key=value " to every line the calling thread logs while it is alive. The
+    // field is rendered once when the scope opens and copied into each line after the
+    // level. Scopes nest and must close in reverse order, which holding them as locals
+    // guarantees. Fields that no longer fit into kCapacity are left out.
+    class Scope {
+    public:
+        static constexpr std::size_t kCapacity = 256;
+
+        template <typename T>
+        Scope(std::string_view key, T const& value) : restore_(fields_.size) {
+            std::size_t room = kCapacity - restore_;
+            auto result = fmt::format_to_n(fields_.data + restore_, room, "{}={} ", key, value);
+            if (result.size <= room) {
+                fields_.size += result.size;
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() { fields_.size = restore_; }
+
+        // The fields of the calling thread's open scopes, outermost first.
+        static std::string_view fields() noexcept { return {fields_.data, fields_.size}; }
+
+    private:
+        struct Fields {
+            char data[kCapacity];
+            std::size_t size;
+        };
+
+        // Constant-initialized, so reading it costs no more than any other thread_local.
+        static inline thread_local Fields fields_{};
+
+        std::size_t restore_;
+    };
+}
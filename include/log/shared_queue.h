@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "futex.h"
+#include "queue.h"
+
+namespace logging {
+    enum class SharedRole : uint8_t {
+        // Hands every record to the shared queue and never writes.
+        Producer,
+        // Drains the shared queue to its outputs along with its own records.
+        Writer,
+    };
+
+    struct SharedOptions {
+        // POSIX shared memory object, "/name".
+        std::string name;
+        SharedRole role = SharedRole::Producer;
+        // Of the ring, rounded up to a power of two. Attaching needs the same capacity.
+        std::size_t capacity = 16 << 20;
+        // How long a producer waits for room in a full ring before it drops the record.
+        // Records are dropped right away once the writer's process is gone.
+        std::chrono::milliseconds fullWait{100};
+    };
+
+    // A Queue in a POSIX shared memory object, so that processes log into one ring and a
+    // single writer drains it. Producers reserve with the same CAS on the shared tail as
+    // threads do. The writer sleeps on a process-shared futex next to the positions.
+    //
+    // The header holds the writer's process id, which producers check while the ring is
+    // full and while flushing, so a dead writer costs records instead of hanging them.
+    // Reservations carry the producer's process id until committed, and the writer skips
+    // those of a process that died in between. A process that dies in the few
+    // instructions between the reservation and tagging it still wedges the ring; the
+    // way out is to stop all its users, remove() the object and start over. Process ids
+    // are only comparable within one PID namespace, and a writer that exited but was not
+    // reaped yet still counts as alive.
+    class SharedQueue {
+    public:
+        // Creates the object, or attaches to it when another process got there first, and
+        // registers as its writer for that role. Throws std::runtime_error on failure or a
+        // capacity mismatch.
+        explicit SharedQueue(SharedOptions const& options);
+
+        SharedQueue(const SharedQueue&) = delete;
+        SharedQueue& operator=(const SharedQueue&) = delete;
+
+        // Unmaps, the object stays until remove(). A writer marks itself gone first.
+        ~SharedQueue();
+
+        // Unlinks the object. Processes that have it mapped keep using it, those that
+        // attach afterwards get a new, empty one.
+        static void remove(std::string_view name);
+
+        Queue& queue() noexcept { return *queue_; }
+
+        // Reserves like Queue::tryReserve for a producer. While the ring is full it wakes
+        // the writer and waits up to fullWait, or not at all once the writer is gone or an
+        // earlier wait ran out and the ring has stayed full since. nullptr when the record
+        // has to be dropped.
+        char* reserve(std::size_t size);
+
+        // Records reserve() dropped in this process.
+        std::size_t dropped() const noexcept { return dropped_.load(std::memory_order_relaxed); }
+
+        // Whether a writer registered and its process no longer exists, or it detached.
+        bool writerGone() const noexcept;
+
+        // Called by the writer when read() stops short, steps over reservations of
+        // producers that died before committing them.
+        bool skipAbandoned();
+
+        // The word the writer sleeps on while the queue is empty, with the futex shared flag.
+        ::detail::Futex<>& sleeping() noexcept;
+
+        // Called by producers after a commit, wakes the writer if it sleeps.
+        void notify() noexcept;
+
+    private:
+        struct Header;
+
+        Header* header_ = nullptr;
+        std::size_t mapped_ = 0;
+        std::unique_ptr<Queue> queue_;
+        const bool writer_;
+        const std::chrono::milliseconds full_wait_;
+        // This process, the owner of its reservations. A queue is not carried across fork().
+        const int32_t pid_;
+        std::atomic<std::size_t> dropped_{0};
+        // Set when a wait for room ran out, cleared by the next reservation that succeeds.
+        std::atomic<bool> overflowing_{false};
+    };
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <source_location>
+#include <string_view>
+
+#include <fmt/format.h>
+
+#include "digits.h"
+#include "log_level.h"
+
+namespace logging {
+    // "file.cpp" of "/path/to/file.cpp".
+    constexpr std::string_view baseName(std::string_view path) {
+        auto slash = path.rfind('/');
+        return slash == std::string_view::npos ? path : path.substr(slash + 1);
+    }
+
+    // Appends "basename:line [level] " for a location only known at run time.
+    inline void appendSite(fmt::memory_buffer& out, std::source_location const& loc, LogLevel level) {
+        auto name = baseName(loc.file_name());
+        out.append(name.data(), name.data() + name.size());
+        char line[digits::kMaxDecimal + 2];
+        line[0] = ':';
+        char* end = digits::writeUnsigned(line + 1, loc.line());
+        *end++ = ' ';
+        out.append(line, end);
+        auto tag = kLogLevelTags[static_cast<std::size_t>(level)];
+        out.append(tag.data(), tag.data() + tag.size());
+    }
+
+    // "basename:line " of a call site, rendered at compile time along with the rest of
+    // the call's source_location, so a message copies it instead of formatting the path.
+    // Also carries a 16-bit hash of that text, which tells call sites apart cheaply.
+    class SitePrefix {
+    public:
+        static constexpr std::size_t kCapacity = 64;
+
+        constexpr SitePrefix() = default;
+
+        consteval explicit SitePrefix(std::source_location const& loc) {
+            auto name = baseName(loc.file_name());
+            char line[10];
+            std::size_t digits = 0;
+            for (uint32_t value = loc.line(); digits == 0 || value != 0; value /= 10) {
+                line[digits++] = static_cast<char>('0' + value % 10);
+            }
+            if (name.size() + digits + 2 > kCapacity) {
+                return;
+            }
+
+            for (char c : name) {
+                text_[size_++] = c;
+            }
+            text_[size_++] = ':';
+            while (digits != 0) {
+                text_[size_++] = line[--digits];
+            }
+            text_[size_++] = ' ';
+
+            uint32_t hash = 2166136261u;
+            for (std::size_t i = 0; i < size_; ++i) {
+                hash = (hash ^ static_cast<uint8_t>(text_[i])) * 16777619u;
+            }
+            site_ = static_cast<uint16_t>(hash ^ (hash >> 16));
+            if (site_ == 0) {
+                site_ = 1;
+            }
+        }
+
+        // Never 0, unless the name did not fit.
+        uint16_t site() const noexcept { return site_; }
+
+        // False when the name did not fit and nothing was appended.
+        bool appendTo(fmt::memory_buffer& out, LogLevel level) const {
+            if (size_ == 0) {
+                return false;
+            }
+            auto tag = kLogLevelTags[static_cast<std::size_t>(level)];
+            std::size_t size = out.size();
+            out.resize(size + size_ + tag.size());
+            memcpy(out.data() + size, text_, size_);
+            memcpy(out.data() + size + size_, tag.data(), tag.size());
+            return true;
+        }
+
+    private:
+        char text_[kCapacity]{};
+        uint8_t size_ = 0;
+        uint16_t site_ = 0;
+    };
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <liburing.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "deadline.h"
+
+namespace logging {
+    enum class SocketType : uint8_t {
+        // One datagram per record, the way syslog daemons read /dev/log.
+        Datagram,
+        // Records back to back on a connection, for collectors that split lines themselves.
+        Stream,
+    };
+
+    struct SocketOptions {
+        SocketType type = SocketType::Datagram;
+        // Records sent while disconnected are dropped; a reconnect is tried at most this often.
+        std::chrono::milliseconds reconnectInterval{1000};
+    };
+
+    // Forwards records to a Unix domain socket with IORING_OP_SENDMSG on a ring of its own.
+    // A batch goes out as one message per record on a datagram socket and as a single
+    // gathered message on a stream socket. When the peer goes away the socket is reopened
+    // and connected with IORING_OP_CONNECT in the background while the writer carries on.
+    // Waits for completions end at the deadline. The sink then stops sending, and as the
+    // kernel may still read its messages, the owner leaks it instead of destroying it.
+    // Not thread-safe, the owner serializes calls.
+    class SocketSink {
+    public:
+        SocketSink(std::string_view path, SocketOptions options, Deadline const& deadline);
+
+        SocketSink(const SocketSink&) = delete;
+        SocketSink& operator=(const SocketSink&) = delete;
+
+        ~SocketSink();
+
+        // Adds the parts to the batch without copying them. They must stay valid until
+        // flush() returns. A record ends with the part that ends in '\n'.
+        void send(const struct iovec*, int);
+
+        // Sends the batch and waits for the completions.
+        void flush();
+
+        // Whether a wait outlasted the deadline, everything sent since is dropped.
+        bool abandoned() const noexcept { return abandoned_; }
+
+    private:
+        enum class State : uint8_t { Disconnected, Connecting, Connected };
+
+        struct Message {
+            std::size_t first = 0;
+            std::size_t count = 0;
+        };
+
+        void connect();
+        void reapConnect(bool wait);
+        void sendMessages();
+        void disconnect(int error);
+        bool waitCqe(struct io_uring_cqe** cqe);
+
+        struct io_uring ring_;
+        Deadline const& deadline_;
+        struct sockaddr_un address_{};
+        socklen_t address_size_ = 0;
+        SocketOptions options_;
+        int fd_ = -1;
+        State state_ = State::Disconnected;
+        std::chrono::steady_clock::time_point retry_at_{};
+
+        std::vector<struct iovec> parts_;
+        std::vector<Message> messages_;
+        std::vector<struct msghdr> headers_;
+        // Start of the record the next part belongs to.
+        std::size_t open_ = 0;
+        uint64_t dropped_ = 0;
+        bool abandoned_ = false;
+    };
+}
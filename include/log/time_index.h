@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace logging {
+    // On-disk layout of "<log>.idx": a header followed by one entry per interval bytes of
+    // the log, holding the timestamp of the first record that starts in that block.
+    struct TimeIndexHeader {
+        char magic[8] = {'L', 'O', 'G', 'I', 'D', 'X', '1', '\0'};
+        uint64_t interval = 0;
+    };
+
+    struct TimeIndexEntry {
+        // Nanoseconds since the epoch, as rendered in the record's prefix.
+        int64_t time;
+        uint64_t offset;
+    };
+
+    // Maintained by the writer, which reports every record in file order. Entries are
+    // appended when the writer flushes a batch, after the batch itself is on disk, so the
+    // index never points past the data.
+    class TimeIndex {
+    public:
+        TimeIndex(std::string const& log_path, std::size_t interval);
+        ~TimeIndex();
+
+        TimeIndex(const TimeIndex&) = delete;
+        TimeIndex& operator=(const TimeIndex&) = delete;
+
+        void add(int64_t time, std::size_t bytes) {
+            if (offset_ >= next_) {
+                pending_.push_back(TimeIndexEntry{time, offset_});
+                next_ = (offset_ / interval_ + 1) * interval_;
+            }
+            offset_ += bytes;
+        }
+
+        void flush();
+
+    private:
+        int fd_ = -1;
+        std::size_t interval_;
+        uint64_t offset_ = 0;
+        uint64_t next_ = 0;
+        std::vector<TimeIndexEntry> pending_;
+    };
+}
@@ -0,0 +1,87 @@
+#include "log/backend.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+logging::Backend::Backend(BackendOptions options, std::function<bool()> poll)
+    : Backend(std::move(options), std::move(poll), own_sleeping_, false) {}
+
+logging::Backend::Backend(BackendOptions options, std::function<bool()> poll, detail::Futex<>& sleeping, bool shared)
+    : options_(std::move(options)), poll_(std::move(poll)), sleeping_(sleeping), shared_(shared) {
+    thread_ = std::thread([this] { run(); });
+}
+
+logging::Backend::~Backend() {
+    stop_.store(true, std::memory_order_release);
+    wake();
+    thread_.join();
+}
+
+void logging::Backend::wake() noexcept {
+    if (sleeping_.exchange(0, std::memory_order_acq_rel) != 0) {
+        detail::futexWake(&sleeping_, 1, -1, shared_);
+    }
+}
+
+void logging::Backend::configureThread() {
+    if (!options_.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : options_.cpus) {
+            CPU_SET(cpu, &set);
+        }
+        if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); err != 0) {
+            fprintf(stderr, "Failed to set log backend affinity: %s\n", strerror(err));
+        }
+    }
+
+    struct sched_param param{};
+    param.sched_priority = options_.schedPriority;
+    if (int err = pthread_setschedparam(pthread_self(), options_.schedPolicy, &param); err != 0) {
+        fprintf(stderr, "Failed to set log backend scheduling policy: %s\n", strerror(err));
+    }
+
+    // Linux applies the nice value of PRIO_PROCESS to a single thread when given its tid.
+    if (options_.niceValue != 0 && setpriority(PRIO_PROCESS, gettid(), options_.niceValue) != 0) {
+        fprintf(stderr, "Failed to set log backend nice value: %s\n", strerror(errno));
+    }
+}
+
+void logging::Backend::run() {
+    configureThread();
+
+    uint32_t spins = 0;
+    while (!stop_.load(std::memory_order_acquire)) {
+        if (poll_()) {
+            spins = 0;
+            continue;
+        }
+
+        if (options_.idle == IdleStrategy::BusySpin || spins < options_.spinIterations) {
+            ++spins;
+            asm volatile("pause");
+            continue;
+        }
+
+        if (options_.idle == IdleStrategy::SpinThenYield) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Announce the sleep before the last look at the queue; producers publish before
+        // they check the flag, so one of the two sides always sees the other.
+        sleeping_.store(1, std::memory_order_seq_cst);
+        if (!poll_() && !stop_.load(std::memory_order_acquire)) {
+            detail::futexWaitUntil(&sleeping_, 1, std::chrono::steady_clock::now() + options_.sleepTimeout, -1, shared_);
+        }
+        sleeping_.store(0, std::memory_order_relaxed);
+        spins = 0;
+    }
+
+    while (poll_()) {
+    }
+}
@@ -0,0 +1,25 @@
+#include "log/call_site.h"
+
+logging::CallSiteTable::~CallSiteTable() {
+    for (auto& slot : table_) {
+        delete slot.load(std::memory_order_relaxed);
+    }
+}
+
+logging::CallSite& logging::CallSiteTable::insert(std::source_location const& loc, std::size_t idx) noexcept {
+    CallSite* fresh = new CallSite(loc);
+    for (std::size_t probe = 0; probe < kCapacity; ++probe) {
+        CallSite* expected = nullptr;
+        if (table_[idx].compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)) {
+            return *fresh;
+        }
+        // Lost the race, possibly against another thread registering the same site.
+        if (expected->matches(loc)) {
+            delete fresh;
+            return *expected;
+        }
+        idx = (idx + 1) & (kCapacity - 1);
+    }
+    delete fresh;
+    return overflow_;
+}
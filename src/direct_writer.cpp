@@ -0,0 +1,202 @@
+#include "log/direct_writer.h"
+#include "log/memory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    constexpr uint64_t roundUp(uint64_t value, uint64_t to) {
+        return (value + to - 1) / to * to;
+    }
+}
+
+logging::DirectWriter::DirectWriter(struct io_uring& ring, Deadline const& deadline, int fd, uint64_t preallocate_bytes, MemoryOptions const& memory)
+    : ring_(ring), deadline_(deadline), fd_(fd), preallocate_bytes_(preallocate_bytes), memory_(memory) {
+    struct iovec iov[kBufferCount];
+    for (size_t i = 0; i < kBufferCount; ++i) {
+        buffers_[i].data = static_cast<char*>(allocatePages(kBufferSize, memory_));
+        iov[i] = {buffers_[i].data, kBufferSize};
+    }
+    registered_ = io_uring_register_buffers(&ring_, iov, kBufferCount) == 0;
+
+    // Appending to an existing log starts by reloading its last block, without the
+    // padding a writer that did not close leaves behind.
+    struct stat st;
+    uint64_t size = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    offset_ = size == 0 ? 0 : (size - 1) / kBlockSize * kBlockSize;
+    fill_ = size - offset_;
+    if (fill_ != 0 && pread(fd_, buffers_[0].data, kBlockSize, offset_) < static_cast<ssize_t>(fill_)) {
+        fprintf(stderr, "Failed to read the last block of the log file\n");
+        memset(buffers_[0].data, 0, fill_);
+    }
+    while (fill_ != 0 && buffers_[0].data[fill_ - 1] == '\0') {
+        --fill_;
+    }
+    if (fill_ == kBlockSize) {
+        offset_ += kBlockSize;
+        fill_ = 0;
+    }
+    allocated_ = roundUp(size, kBlockSize);
+}
+
+logging::DirectWriter::~DirectWriter() {
+    flush();
+    if (abandoned_) {
+        // Writes may still be in flight, they keep the buffers pinned until they end.
+        // Unregistering them would wait for those writes.
+        return;
+    }
+
+    uint64_t end = roundUp(offset_ + fill_, kBlockSize);
+    if (allocated_ > end) {
+        fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, end, allocated_ - end);
+    }
+    if (ftruncate(fd_, offset_ + fill_) != 0) {
+        fprintf(stderr, "Failed to truncate the log file: %s\n", strerror(errno));
+    }
+
+    if (registered_) {
+        io_uring_unregister_buffers(&ring_);
+    }
+    for (auto& buffer : buffers_) {
+        freePages(buffer.data, kBufferSize, memory_);
+    }
+}
+
+void logging::DirectWriter::append(const struct iovec* parts, int num_parts) {
+    if (abandoned_) {
+        return;
+    }
+    for (int i = 0; i < num_parts; ++i) {
+        auto data = static_cast<const char*>(parts[i].iov_base);
+        size_t len = parts[i].iov_len;
+        while (len != 0) {
+            size_t chunk = std::min(len, kBufferSize - fill_);
+            memcpy(buffers_[current_].data + fill_, data, chunk);
+            fill_ += chunk;
+            data += chunk;
+            len -= chunk;
+
+            if (fill_ == kBufferSize) {
+                submitBuffer(kBufferSize);
+                offset_ += kBufferSize;
+                nextBuffer();
+                if (abandoned_) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+bool logging::DirectWriter::flush() {
+    if (abandoned_) {
+        return false;
+    }
+    if (fill_ != 0) {
+        size_t padded = roundUp(fill_, kBlockSize);
+        memset(buffers_[current_].data + fill_, 0, padded - fill_);
+        submitBuffer(padded);
+    }
+    while (in_flight_ != 0) {
+        if (!reap()) {
+            abandon();
+            return false;
+        }
+    }
+
+    // Whole blocks are final, only the partial one is carried over to the next flush.
+    size_t tail = fill_ % kBlockSize;
+    size_t full = fill_ - tail;
+    if (full != 0 && tail != 0) {
+        memmove(buffers_[current_].data, buffers_[current_].data + full, tail);
+    }
+    offset_ += full;
+    fill_ = tail;
+    return !std::exchange(failed_, false);
+}
+
+void logging::DirectWriter::submitBuffer(size_t len) {
+    preallocate(offset_ + len);
+
+    struct io_uring_sqe* sqe;
+    while (!(sqe = io_uring_get_sqe(&ring_))) {
+        if (!reap()) {
+            abandon();
+            return;
+        }
+    }
+
+    Buffer& buffer = buffers_[current_];
+    if (registered_) {
+        io_uring_prep_write_fixed(sqe, fd_, buffer.data, len, offset_, current_);
+    } else {
+        io_uring_prep_write(sqe, fd_, buffer.data, len, offset_);
+    }
+    sqe->user_data = current_;
+    buffer.length = len;
+    buffer.in_flight = true;
+    ++in_flight_;
+    io_uring_submit(&ring_);
+}
+
+void logging::DirectWriter::nextBuffer() {
+    current_ = (current_ + 1) % kBufferCount;
+    while (buffers_[current_].in_flight) {
+        if (!reap()) {
+            abandon();
+            break;
+        }
+    }
+    fill_ = 0;
+}
+
+bool logging::DirectWriter::reap() {
+    struct io_uring_cqe* cqe;
+    if (int result = deadline_.waitCqe(&ring_, &cqe); result != 0) {
+        // Past the deadline, or the wait itself failed: either way nothing more completes.
+        if (result != -ETIME) {
+            fprintf(stderr, "Failed to wait for direct writes to the log file: %s\n", strerror(-result));
+        }
+        return false;
+    }
+    Buffer& buffer = buffers_[cqe->user_data];
+    if (cqe->res < 0) {
+        fprintf(stderr, "Direct write to the log file failed: %s\n", strerror(-cqe->res));
+        failed_ = true;
+    } else if (static_cast<size_t>(cqe->res) < buffer.length) {
+        fprintf(stderr, "Short direct write to the log file, %d of %zu bytes\n", cqe->res, buffer.length);
+        failed_ = true;
+    }
+    buffer.in_flight = false;
+    --in_flight_;
+    io_uring_cqe_seen(&ring_, cqe);
+    return true;
+}
+
+void logging::DirectWriter::abandon() {
+    if (!abandoned_) {
+        fprintf(stderr, "Gave up waiting for %u direct writes to the log file\n", in_flight_);
+    }
+    abandoned_ = true;
+}
+
+void logging::DirectWriter::preallocate(uint64_t end) {
+    if (preallocate_bytes_ == 0 || end <= allocated_) {
+        return;
+    }
+
+    uint64_t target = roundUp(end + preallocate_bytes_, kBlockSize);
+    if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, allocated_, target - allocated_) != 0) {
+        // Filesystems without fallocate simply grow the file on write.
+        preallocate_bytes_ = 0;
+        return;
+    }
+    allocated_ = target;
+}
@@ -2,10 +2,10 @@
 
 namespace detail {
     FutexResult nativeFutexWaitImpl(const void* addr, uint32_t expected, std::chrono::system_clock::time_point const* absSystemTime, 
-                                    std::chrono::steady_clock::time_point const* absSteadyTime, uint32_t waitMask) {
+                                    std::chrono::steady_clock::time_point const* absSteadyTime, uint32_t waitMask, bool shared) {
         assert(absSystemTime == nullptr || absSteadyTime == nullptr);
 
-        int op = FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG;
+        int op = FUTEX_WAIT_BITSET | (shared ? 0 : FUTEX_PRIVATE_FLAG);
         struct timespec ts;
         struct timespec* timeout = nullptr;
 
@@ -14,7 +14,7 @@ namespace detail {
             ts = timeSpecFromTimePoint(*absSystemTime);
             timeout = &ts;
         } else if (absSteadyTime != nullptr) {
-            ts = timeSpecFromTimePoint(*absSystemTime);
+            ts = timeSpecFromTimePoint(*absSteadyTime);
             timeout = &ts;
         }
 
@@ -45,11 +45,11 @@ namespace detail {
         }
     }
 
-    int nativeFutexWakeImpl(const void* addr, int count, uint32_t wakeMask) {
+    int nativeFutexWakeImpl(const void* addr, int count, uint32_t wakeMask, bool shared) {
         int rv = syscall(
             __NR_futex,
             addr,
-            FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+            FUTEX_WAKE_BITSET | (shared ? 0 : FUTEX_PRIVATE_FLAG),
             count,
             nullptr,
             nullptr,
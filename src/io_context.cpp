@@ -1,78 +1,269 @@
 #include "log/io_context.h"
+#include <algorithm>
 #include <iostream>
 
-logging::IoContext::IoContext() {
+#include <limits.h>
+
+logging::IoContext::IoContext() : IoContext(IoOptions{}) {}
+
+logging::IoContext::IoContext(IoOptions options) : options_(options) {
     if (const int result = io_uring_queue_init(QUEUE_DEPTH, &io_uring_, 0); result != 0) {
         throw std::runtime_error("Failed to invoke 'io_uring_queue_init'");
     }
 }
 
 logging::IoContext::~IoContext() {
-    if (count_ != 0) {
-        io_uring_submit(&io_uring_);
-        
-        struct io_uring_cqe* cqe;
-        for (int i = 0; i < count_; ++i) {
-            int ret_wait = io_uring_wait_cqe(&io_uring_, &cqe);  // Block until a completion is available
+    submit();
+    if (socket_ && socket_->abandoned()) {
+        // Sends given up on at the deadline may still read the sink's messages.
+        socket_.release();
+    }
+    direct_.reset();
+    io_uring_queue_exit(&io_uring_);
+}
 
-            // Free the buffer once the write is completed
-            char* completed_buffer = reinterpret_cast<char*>(cqe->user_data);
-            delete[] completed_buffer;
+uint64_t logging::IoContext::reserveOffset(size_t len) {
+    // With O_APPEND the kernel ignores the offset, so 0 is as good as any.
+    return options_.globalOrder ? file_offset_.fetch_add(len, std::memory_order_relaxed) : 0;
+}
 
-            io_uring_cqe_seen(&io_uring_, cqe);  // Mark CQE as seen
-        }        
+void logging::IoContext::writev(const struct iovec* parts, int num_parts) {
+    size_t len = 0;
+    for (int i = 0; i < num_parts; ++i) {
+        len += parts[i].iov_len;
     }
-    io_uring_queue_exit(&io_uring_);
+
+    if (socket_) {
+        // The parts are the caller's, they go out before returning.
+        std::lock_guard lock(socket_mutex_);
+        socket_->send(parts, num_parts);
+        socket_->flush();
+    }
+    if (pipe_) {
+        std::lock_guard lock(pipe_mutex_);
+        pipe_->write(parts, num_parts);
+    }
+    if (fds[0] == -1) {
+        return;
+    }
+
+    if (direct_) {
+        std::lock_guard lock(direct_mutex_);
+        direct_->append(parts, num_parts);
+        return;
+    }
+
+    queueSqe([&](struct io_uring_sqe* sqe) {
+        // Allocate a new buffer for each message to avoid overwriting. Its length leads
+        // it, so the completion can tell a short write.
+        char* new_buffer = new char[sizeof(uint64_t) + len];
+        const uint64_t length = len;
+        memcpy(new_buffer, &length, sizeof(length));
+        for (int i = 0, offset = sizeof(length); i < num_parts; offset += parts[i].iov_len, ++i) {
+            memcpy(new_buffer + offset, parts[i].iov_base, parts[i].iov_len);
+        }
+
+        // Prepare the write operation using the unique buffer
+        io_uring_prep_write(sqe, fds[0], new_buffer + sizeof(length), len, reserveOffset(len));
+        sqe->user_data = reinterpret_cast<uint64_t>(new_buffer);  // Store the buffer address in user_data
+    });
 }
 
-void logging::IoContext::write(const char* message, size_t len) {
-    turn_sequencer_.waitForTurn(turn_, spinCutoff_, true);
+void logging::IoContext::writevBorrowed(const struct iovec* parts, int num_parts) {
+    if (socket_) {
+        std::lock_guard lock(socket_mutex_);
+        socket_->send(parts, num_parts);
+    }
+    if (pipe_) {
+        std::lock_guard lock(pipe_mutex_);
+        pipe_->splice(parts, num_parts);
+    }
+    if (fds[0] == -1) {
+        return;
+    }
+
+    if (direct_) {
+        std::lock_guard lock(direct_mutex_);
+        direct_->append(parts, num_parts);
+        return;
+    }
+
+    while (num_parts > 0) {
+        int chunk = std::min(num_parts, IOV_MAX);
+        size_t len = 0;
+        for (int i = 0; i < chunk; ++i) {
+            len += parts[i].iov_len;
+        }
+
+        queueSqe([&](struct io_uring_sqe* sqe) {
+            io_uring_prep_writev(sqe, fds[0], parts, chunk, reserveOffset(len));
+            // Odd, unlike a buffer address: no buffer to free, only the length to check.
+            sqe->user_data = uint64_t{len} << 1 | 1;
+        });
+        parts += chunk;
+        num_parts -= chunk;
+    }
+}
+
+template <typename Prep>
+void logging::IoContext::queueSqe(Prep&& prep) {
+    // Each writer takes a ticket, so preparing SQEs and submitting never overlap.
+    uint32_t turn = turn_.fetch_add(1, std::memory_order_acq_rel);
+    turn_sequencer_.waitForTurn(turn, spinCutoff_, true);
     struct io_uring_sqe* sqe = io_uring_get_sqe(&io_uring_);
     if (!sqe) {
         fprintf(stderr, "Failed to get submission queue entry\n");
+        turn_sequencer_.completeTurn(turn);
         return;
     }
 
-    // Allocate a new buffer for each message to avoid overwriting
-    char* new_buffer = new char[len];
-    memcpy(new_buffer, message, len);
-
-    // Prepare the write operation using the unique buffer
-    io_uring_prep_write(sqe, fds[0], new_buffer, len, 0);
-    sqe->user_data = reinterpret_cast<uint64_t>(new_buffer);  // Store the buffer address in user_data
-
-    // int count = count_.fetch_add(1, std::memory_order_acq_rel) + 1;  // Increment and get the new value
-    int turn = turn_.fetch_add(1, std::memory_order_acq_rel);
-    turn_sequencer_.completeTurn(turn);
+    prep(sqe);
 
     // Atomically increment count before the condition check
     int count = count_.fetch_add(1, std::memory_order_acq_rel) + 1;  // Increment and get the new value
+    turn_sequencer_.completeTurn(turn);
 
     if (count == QUEUE_DEPTH / 2) {
-        io_uring_submit(&io_uring_);
-        
+        submit();
+    }
+}
+
+void logging::IoContext::setDeadline(std::chrono::steady_clock::time_point deadline) {
+    deadline_.set(deadline);
+}
+
+bool logging::IoContext::submit() {
+    if (socket_) {
+        std::lock_guard lock(socket_mutex_);
+        socket_->flush();
+        if (socket_->abandoned()) {
+            abandoned_.store(true, std::memory_order_release);
+        }
+    }
+
+    bool complete;
+    if (direct_) {
+        std::lock_guard lock(direct_mutex_);
+        complete = direct_->flush();
+    } else {
+        uint32_t turn = turn_.fetch_add(1, std::memory_order_acq_rel);
+        turn_sequencer_.waitForTurn(turn, spinCutoff_, true);
         // Reset the counter to 0 atomically
-        count_.store(0, std::memory_order_release);
+        complete = submitRing(io_uring_, count_.exchange(0, std::memory_order_acq_rel));
+        turn_sequencer_.completeTurn(turn);
+    }
 
-        struct io_uring_cqe* cqe;
-        for (int i = 0; i < QUEUE_DEPTH / 2; ++i) {
-            int ret_wait = io_uring_wait_cqe(&io_uring_, &cqe);  // Block until a completion is available
+    if (pipe_) {
+        // Spliced parts are the caller's pages, they are handed back once the reader took them.
+        std::lock_guard lock(pipe_mutex_);
+        complete = pipe_->consumed() && complete;
+        if (pipe_->abandoned()) {
+            abandoned_.store(true, std::memory_order_release);
+        }
+    }
+    return complete;
+}
 
-            // Free the buffer once the write is completed
-            char* completed_buffer = reinterpret_cast<char*>(cqe->user_data);
-            delete[] completed_buffer;
+bool logging::IoContext::submitRing(struct io_uring& ring, uint32_t count) {
+    if (count == 0) {
+        return true;
+    }
 
-            io_uring_cqe_seen(&io_uring_, cqe);  // Mark CQE as seen
+    if (int result = io_uring_submit(&ring); result < 0) {
+        // The writes stay in the submission queue, a later submit may still pick them up.
+        fprintf(stderr, "Failed to submit %u writes to the log file: %s\n", count, strerror(-result));
+        abandoned_.store(true, std::memory_order_release);
+        return false;
+    }
+
+    bool complete = true;
+    struct io_uring_cqe* cqe;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (int result = deadline_.waitCqe(&ring, &cqe); result != 0) {
+            // The rest stay queued in the kernel. Their copies leak rather than being freed
+            // under a write that may still read them.
+            if (result == -ETIME) {
+                fprintf(stderr, "Gave up waiting for %u writes to the log file\n", count - i);
+            } else {
+                fprintf(stderr, "Failed to wait for %u writes to the log file: %s\n", count - i, strerror(-result));
+            }
+            abandoned_.store(true, std::memory_order_release);
+            return false;
+        }
+
+        char* completed_buffer = nullptr;
+        uint64_t length;
+        if (cqe->user_data & 1) {
+            length = cqe->user_data >> 1;
+        } else {
+            completed_buffer = reinterpret_cast<char*>(cqe->user_data);
+            memcpy(&length, completed_buffer, sizeof(length));
+        }
+        if (cqe->res < 0) {
+            fprintf(stderr, "Failed to write to the log file: %s\n", strerror(-cqe->res));
+            complete = false;
+        } else if (static_cast<uint64_t>(cqe->res) < length) {
+            fprintf(stderr, "Short write to the log file, %d of %lu bytes\n", cqe->res, static_cast<unsigned long>(length));
+            complete = false;
         }
+
+        // Free the buffer once the write is completed
+        delete[] completed_buffer;
+
+        io_uring_cqe_seen(&ring, cqe);  // Mark CQE as seen
     }
+    return complete;
 }
 
 int logging::IoContext::register_file(std::string_view file_path) {
-    fds[0] = open(file_path.data(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (options_.directIo) {
+        fds[0] = open(file_path.data(), O_RDWR | O_CREAT | O_DIRECT, S_IRUSR | S_IWUSR);
+        if (fds[0] == -1 && errno == EINVAL) {
+            // tmpfs and a few others refuse O_DIRECT, the same aligned writes still work.
+            std::cerr << "O_DIRECT is not supported for the log file, using buffered writes" << std::endl;
+            fds[0] = open(file_path.data(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        }
+        if (fds[0] == -1) {
+            std::cerr << "Error opening file" << std::endl;
+            return 1;
+        }
+        direct_ = std::make_unique<DirectWriter>(io_uring_, deadline_, fds[0], options_.preallocateBytes, options_.memory);
+        return 0;
+    }
+
+    int flags = O_WRONLY | O_CREAT | (options_.globalOrder ? 0 : O_APPEND);
+    fds[0] = open(file_path.data(), flags, S_IRUSR | S_IWUSR);
     if (fds[0] == -1) {
         std::cerr << "Error opening file" << std::endl;
         return 1;
     }
 
+    if (options_.globalOrder) {
+        struct stat st;
+        file_offset_.store(fstat(fds[0], &st) == 0 ? st.st_size : 0, std::memory_order_relaxed);
+    }
+
+    return 0;
+}
+
+int logging::IoContext::register_socket(std::string_view path, SocketOptions options) {
+    std::lock_guard lock(socket_mutex_);
+    try {
+        socket_ = std::make_unique<SocketSink>(path, options, deadline_);
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int logging::IoContext::register_pipe(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+        std::cerr << "The log pipe is not a pipe" << std::endl;
+        return 1;
+    }
+    std::lock_guard lock(pipe_mutex_);
+    pipe_ = std::make_unique<PipeSink>(fd, deadline_);
     return 0;
 }
@@ -0,0 +1,36 @@
+#include "log/io_engine.h"
+#include "log/io_context.h"
+#include "log/mmap_engine.h"
+#include "log/pwritev_engine.h"
+
+#include <iostream>
+
+int logging::IoEngine::register_socket(std::string_view, SocketOptions) {
+    std::cerr << "The " << name() << " engine cannot send to a socket" << std::endl;
+    return 1;
+}
+
+int logging::IoEngine::register_pipe(int) {
+    std::cerr << "The " << name() << " engine cannot feed a pipe" << std::endl;
+    return 1;
+}
+
+std::unique_ptr<logging::IoEngine> logging::makeIoEngine(IoOptions const& options) {
+    switch (options.engine) {
+    case IoEngineKind::IoUring:
+        return std::make_unique<IoContext>(options);
+    case IoEngineKind::Pwritev:
+        return std::make_unique<PwritevEngine>();
+    case IoEngineKind::Mmap:
+        return std::make_unique<MmapEngine>();
+    case IoEngineKind::Auto:
+        break;
+    }
+
+    try {
+        return std::make_unique<IoContext>(options);
+    } catch (std::runtime_error const& e) {
+        std::cerr << e.what() << ", falling back to the pwritev engine" << std::endl;
+        return std::make_unique<PwritevEngine>();
+    }
+}
@@ -1,38 +1,777 @@
 #include "log/log.h"
 
+#include <pthread.h>
+
+namespace {
+	// Rendered "<tid>[/<name>] " for the calling thread, built once per thread and on rename.
+	struct ThreadTag {
+		char data[64];
+		std::size_t size = 0;
+	};
+
+	thread_local ThreadTag thread_tag;
+
+	std::atomic<uint64_t> next_log_id{1};
+
+	void renderThreadTag(std::string_view name) {
+		auto result = fmt::format_to_n(thread_tag.data, sizeof(thread_tag.data) - 1, "{}", gettid());
+		std::size_t size = result.size;
+		if (!name.empty()) {
+			thread_tag.data[size++] = '/';
+			std::size_t len = std::min(name.size(), sizeof(thread_tag.data) - size - 1);
+			memcpy(thread_tag.data + size, name.data(), len);
+			size += len;
+		}
+		thread_tag.data[size++] = ' ';
+		thread_tag.size = size;
+	}
+
+	std::string_view threadTag() {
+		if (thread_tag.size == 0) {
+			renderThreadTag({});
+		}
+		return {thread_tag.data, thread_tag.size};
+	}
+}
+
+logging::Log::Log() : Log(IoOptions{}) {}
+
+logging::Log::Log(IoOptions io) : Log(makeIoEngine(io), io.memory) {}
+
+logging::Log::Log(std::unique_ptr<IoEngine> io, MemoryOptions const& memory) : id_(next_log_id.fetch_add(1, std::memory_order_relaxed)), io_(std::move(io)) {
+	for (int node : NumaTopology::get().nodes()) {
+		MemoryOptions local = memory;
+		local.node = node;
+		queues_.push_back(std::make_unique<Queue>(kQueueCapacity, local));
+	}
+	priority_ = std::make_unique<Queue>(kPriorityCapacity, memory);
+
+	loggers_[0].reset(new Logger(*this, 0, nullptr, {}));
+	logger_count_ = 1;
+}
+
+logging::Log::Log(BackendOptions options, IoOptions io) : Log(io) {
+	threaded_ = true;
+	backend_ = std::make_unique<Backend>(std::move(options), [this] { return drain(); });
+}
+
+logging::Log::Log(SharedOptions const& shared, BackendOptions options, IoOptions io)
+	: Log(shared.role == SharedRole::Producer ? nullptr : makeIoEngine(io), io.memory) {
+	shared_ = std::make_unique<SharedQueue>(shared);
+	producer_ = shared.role == SharedRole::Producer;
+	if (!producer_) {
+		// Producers in other processes wake the writer through the word in shared memory.
+		threaded_ = true;
+		backend_ = std::make_unique<Backend>(std::move(options), [this] { return drain(); }, shared_->sleeping(), true);
+	}
+}
+
 logging::Log::~Log() {
-	while (!mpmc_.isEmpty()) {
-		std::string pop_msg{};
-		mpmc_.read(pop_msg);
+	shutdown(std::chrono::steady_clock::time_point::max());
+	if (abandoned_) {
+		// Writes given up on may still read the queues, the tags and the lines of their
+		// pass, so all of those leak.
+		for (auto& queue : queues_) {
+			queue.release();
+		}
+		priority_.release();
+		shared_.release();
+		for (auto& logger : loggers_) {
+			logger.release();
+		}
+		new std::deque<std::string>(std::move(repeat_lines_));
+	}
+}
 
-		io_context_.write(pop_msg.data(), pop_msg.size());
+std::size_t logging::Log::shutdown(std::chrono::steady_clock::time_point deadline) {
+	if (shut_down_) {
+		return 0;
 	}
+	shut_down_ = true;
+
+	if (RateLimit limit = rate_limit_.load(); limit.enabled()) {
+		call_sites_.forEach([&](CallSite& site) {
+			if (auto suppressed = site.takeSuppressed(limit, true)) {
+				addSuppressedSummary(0, logging::LogLevel::info, site, suppressed);
+			}
+		});
+	}
+	closed_.store(true);
+	while (in_flight_.load() != 0) {
+		std::this_thread::yield();
+	}
+	if (producer_) {
+		std::size_t dropped = shared_->dropped();
+		if (dropped != 0) {
+			fprintf(stderr, "The shared log queue stayed full, %zu records were dropped\n", dropped);
+		}
+		return dropped;
+	}
+
+	// Set before stopping the backend, whose last passes and a wait it is stuck in
+	// give up at the deadline as well.
+	deadline_.set(deadline);
+	io_->setDeadline(deadline);
+	backend_.reset();
+
+	while (drain()) {
+	}
+	std::size_t lost = unpersisted_ + discardQueued();
+	completeFlushes(true);
+	{
+		std::lock_guard lock(flush_mutex_);
+		resumer_stop_ = true;
+	}
+	resume_cv_.notify_one();
+	if (resumer_.joinable()) {
+		resumer_.join();
+	}
+	if (lost != 0) {
+		fprintf(stderr, "The log shut down with %zu records not persisted\n", lost);
+	}
+	return lost;
+}
+
+bool logging::Log::hasOutputs() const {
+	if (!io_) {
+		std::cerr << "A shared log producer has no outputs, its writer does" << std::endl;
+	}
+	return io_ != nullptr;
 }
 
 void logging::Log::setOutputFile(std::string_view file_path) {
+	if (!hasOutputs()) {
+		return;
+	}
 	file_path_ = file_path;
-	io_context_.register_file(file_path_);
+	setTimeIndex(index_interval_);
+	io_->register_file(file_path_);
 }
 
-std::string logging::Log::getPrefix() {
-    // Get current time
-    auto now = std::chrono::system_clock::now();
-    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
-    auto time = std::chrono::system_clock::to_time_t(now);
+void logging::Log::setOutputSocket(std::string_view path, SocketOptions const& options) {
+	if (!hasOutputs()) {
+		return;
+	}
+	io_->register_socket(path, options);
+}
+
+void logging::Log::setOutputPipe(int fd) {
+	if (!hasOutputs()) {
+		return;
+	}
+	io_->register_pipe(fd);
+}
+
+void logging::Log::setTimeIndex(std::size_t interval) {
+	index_interval_ = interval;
+	index_.reset();
+	if (interval != 0 && !file_path_.empty()) {
+		index_ = std::make_unique<TimeIndex>(file_path_, interval);
+	}
+}
+
+logging::Logger& logging::Log::get(std::string_view name) {
+	std::lock_guard lock(loggers_mutex_);
+
+	Logger* parent = loggers_[0].get();
+	std::size_t end = 0;
+	while (end != name.size()) {
+		end = std::min(name.find('.', end + 1), name.size());
+		auto prefix = name.substr(0, end);
+
+		Logger* found = nullptr;
+		for (uint16_t id = 1; id < logger_count_; ++id) {
+			if (loggers_[id]->name() == prefix) {
+				found = loggers_[id].get();
+				break;
+			}
+		}
+
+		if (!found) {
+			if (logger_count_ == kMaxLoggers) {
+				throw std::length_error("Too many loggers");
+			}
+			found = new Logger(*this, logger_count_, parent, prefix);
+			found->level_.store(parent->level(), std::memory_order_relaxed);
+			loggers_[logger_count_++].reset(found);
+		}
+		parent = found;
+	}
+	return *parent;
+}
+
+void logging::Log::setLevel(logging::LogLevel level) {
+	root().setLevel(level);
+}
+
+void logging::Logger::setLevel(logging::LogLevel level) {
+	std::lock_guard lock(log_.loggers_mutex_);
+	explicit_level_ = true;
+	own_level_ = level;
+	log_.updateLevels();
+}
+
+void logging::Logger::resetLevel() {
+	std::lock_guard lock(log_.loggers_mutex_);
+	explicit_level_ = false;
+	log_.updateLevels();
+}
+
+void logging::Log::updateLevels() {
+	// Parents are always created before their children, so one pass in id order settles
+	// every effective level.
+	for (uint16_t id = 0; id < logger_count_; ++id) {
+		Logger& logger = *loggers_[id];
+		auto level = logger.explicit_level_ || !logger.parent_ ? logger.own_level_ : logger.parent_->level();
+		logger.level_.store(level, std::memory_order_relaxed);
+	}
+}
+
+void logging::Log::setRateLimit(RateLimit const& limit) {
+	rate_limit_.store(limit);
+}
+
+void logging::Log::setRepeatWindow(std::chrono::milliseconds window) {
+	repeat_window_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(window).count(), std::memory_order_relaxed);
+}
+
+void logging::Log::setBacktrace(std::size_t depth) {
+	backtrace_depth_.store(depth, std::memory_order_relaxed);
+}
 
-    // Get thread ID
-    std::thread::id this_id = std::this_thread::get_id();
-	auto thread_id_hash = std::hash<std::thread::id>{}(this_id);
+logging::BacktraceRing& logging::Log::backtraceRing() {
+	thread_local BacktraceRing ring;
+	return ring;
+}
+
+void logging::Log::dumpBacktrace() {
+	BacktraceRing& ring = backtraceRing();
+	if (!ring.ownedBy(id_, backtrace_depth_.load(std::memory_order_relaxed))) {
+		return;
+	}
+
+	fmt::memory_buffer& buffer = threadBuffer();
+	ring.drain([&](BacktraceSlot const& slot) {
+		buffer.clear();
+		appendPrefix(buffer, slot.time);
+		auto prefix_size = buffer.size();
+		appendSite(buffer, slot.loc, slot.level);
+		slot.format(buffer, slot);
+		buffer.push_back('\n');
+		enqueue(Record{slot.logger, static_cast<uint16_t>(prefix_size), slot.level, 0, 0, slot.time}, {buffer.data(), buffer.size()});
+	});
+}
+
+std::future<void> logging::Log::flush() {
+	std::promise<void> promise;
+	auto future = promise.get_future();
+	if (!registerFlush(flushTargets(), &promise, {})) {
+		promise.set_value();
+	}
+	return future;
+}
+
+logging::FlushAwaiter logging::Log::flushAsync() {
+	return FlushAwaiter(*this, flushTargets());
+}
+
+logging::Log::FlushTargets logging::Log::flushTargets() const {
+	FlushTargets targets;
+	targets.reserve(queues_.size() + 1);
+	for (auto& queue : queues_) {
+		targets.push_back(queue->writePosition());
+	}
+	targets.push_back(priority_->writePosition());
+	return targets;
+}
+
+bool logging::Log::registerFlush(FlushTargets targets, std::promise<void>* promise, std::coroutine_handle<> handle) {
+	if (producer_) {
+		// Only the writer process knows what is written, its release position tells.
+		// Without a writer left nothing is going to be written, the flush resolves anyway.
+		const uint64_t target = shared_->queue().writePosition();
+		shared_->notify();
+		while (shared_->queue().releasePosition() < target && !shared_->writerGone()) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return false;
+	}
+	InFlight in_flight(*this);
+	if (closed_.load()) {
+		// Shutdown writes or discards everything queued before it returns.
+		return false;
+	}
+	if (!threaded_) {
+		// Another thread may hold back a pass, with a reservation still being filled or
+		// records held behind an urgent one, so passes repeat until the targets are written.
+		while (!flushed(targets) && !closed_.load(std::memory_order_acquire)) {
+			if (!drain()) {
+				std::this_thread::yield();
+			}
+		}
+		return false;
+	}
 
-    // Use fmt for formatting the prefix string
-    return fmt::format("{:%Y-%m-%d %H:%M:%S}.{:09d} {} ", *std::localtime(&time), (ns % 1000000000), thread_id_hash);
+	{
+		std::lock_guard lock(flush_mutex_);
+		if (handle && !resumer_.joinable()) {
+			resumer_ = std::thread([this] { resumeFlushed(); });
+		}
+		flush_waiters_.push_back(FlushWaiter{std::move(targets), promise ? std::move(*promise) : std::promise<void>{}, handle});
+		flush_pending_.fetch_add(1, std::memory_order_release);
+	}
+	// The writer resolves the waiter on its next poll, this makes sure there is one.
+	backend_->notify();
+	return true;
 }
 
-std::string logging::Log::logLevelToString(logging::LogLevel level) {
-	switch(level) {
-#define _FUNCTION(name) case logging::LogLevel::name: return #name;
-	LOGGING_FOR_EACH_LOG_LEVEL(_FUNCTION)
-#undef _FUNCTION
+bool logging::Log::flushed(FlushTargets const& targets) const {
+	// Records are released only after submit() has reaped their writes, so everything
+	// before a queue's release position is on disk.
+	for (std::size_t i = 0; i < queues_.size(); ++i) {
+		if (targets[i] > queues_[i]->releasePosition()) {
+			return false;
+		}
 	}
-	return "UNKNOWN";
+	return targets.back() <= priority_->releasePosition();
+}
+
+void logging::Log::completeFlushes(bool all) {
+	if (flush_pending_.load(std::memory_order_acquire) == 0) {
+		return;
+	}
+
+	std::vector<FlushWaiter> ready;
+	bool resume = false;
+	{
+		std::lock_guard lock(flush_mutex_);
+		auto it = std::partition(flush_waiters_.begin(), flush_waiters_.end(), [&](FlushWaiter const& waiter) {
+			return !all && !flushed(waiter.targets);
+		});
+		for (auto waiter = it; waiter != flush_waiters_.end(); ++waiter) {
+			if (waiter->handle) {
+				resumable_.push_back(waiter->handle);
+				resume = true;
+			} else {
+				ready.push_back(std::move(*waiter));
+			}
+		}
+		flush_pending_.fetch_sub(flush_waiters_.end() - it, std::memory_order_relaxed);
+		flush_waiters_.erase(it, flush_waiters_.end());
+	}
+	if (resume) {
+		resume_cv_.notify_one();
+	}
+
+	for (auto& waiter : ready) {
+		waiter.promise.set_value();
+	}
+}
+
+void logging::Log::resumeFlushed() {
+	// A coroutine resumed on the writer could log into a full queue and wait for itself.
+	std::unique_lock lock(flush_mutex_);
+	while (true) {
+		resume_cv_.wait(lock, [this] { return !resumable_.empty() || resumer_stop_; });
+		if (resumable_.empty()) {
+			return;
+		}
+		auto handles = std::move(resumable_);
+		resumable_.clear();
+		lock.unlock();
+		for (auto handle : handles) {
+			handle.resume();
+		}
+		lock.lock();
+	}
+}
+
+logging::Queue& logging::Log::localQueue() {
+	// Resolved once per thread, so a thread's records never spread over two queues and
+	// keep their order even if the scheduler later moves it to another socket.
+	thread_local std::size_t node_index = NumaTopology::get().currentIndex();
+	return *queues_[node_index < queues_.size() ? node_index : 0];
+}
+
+void logging::Log::enqueue(Record const& record, std::string_view text) {
+	InFlight in_flight(*this);
+	if (closed_.load()) {
+		return;
+	}
+	if (producer_ && record.logger != 0) {
+		// The writer knows none of this process's loggers, so the tag goes into the text.
+		thread_local std::string line;
+		auto const& tag = loggers_[record.logger]->tag_;
+		line.assign(text.substr(0, record.prefixSize)).append(tag).append(text.substr(record.prefixSize));
+		Record untagged = record;
+		untagged.logger = 0;
+		enqueue(untagged, line);
+		return;
+	}
+
+	bool urgent = record.level >= LogLevel::error;
+	auto& queue = producer_ ? shared_->queue() : urgent ? *priority_ : localQueue();
+
+	// Lines too long for the queue lose their tail but keep the newline.
+	std::size_t size = sizeof(Record) + text.size();
+	bool truncated = size > queue.maxRecordSize();
+	if (truncated) {
+		size = queue.maxRecordSize();
+		text = text.substr(0, size - sizeof(Record) - 1);
+	}
+
+	// Never drop on a full queue: the writer, or without one the producer itself, makes room.
+	// A shared producer's writer is another process, it waits a bounded time only.
+	char* slot = nullptr;
+	if (producer_ && !(slot = shared_->reserve(size))) {
+		return;
+	}
+	while (!producer_ && !(slot = queue.tryReserve(size))) {
+		if (closed_.load(std::memory_order_acquire)) {
+			// The writer may have given up at the deadline and shutdown waits for this call.
+			return;
+		} else if (threaded_) {
+			backend_->notify();
+			std::this_thread::yield();
+		} else if (!drain()) {
+			// The oldest reservation is still being filled by another thread.
+			std::this_thread::yield();
+		}
+	}
+	memcpy(slot, &record, sizeof(Record));
+	memcpy(slot + sizeof(Record), text.data(), text.size());
+	if (truncated) {
+		slot[size - 1] = '\n';
+	}
+	queue.commit(slot, size);
+
+	if (producer_) {
+		shared_->notify();
+	} else if (threaded_) {
+		backend_->notify();
+	} else if (urgent || queue.size() >= queue.capacity() / 2) {
+		drain();
+	}
+}
+
+bool logging::Log::drain() {
+	std::unique_lock lock(drain_mutex_, std::defer_lock);
+	if (!threaded_) {
+		lock.lock();
+	}
+	if (abandoned_ || deadline_.passed()) {
+		return false;
+	}
+
+	auto time = [](std::span<char> record) { return reinterpret_cast<Record const*>(record.data())->time; };
+
+	// Nothing is released before the end of the pass, so at most one queue's worth is
+	// taken from each queue, and the priority lane waits for a bounded amount of work.
+	// The lane is read after the queues: a thread commits its urgent record before any
+	// later one, so an urgent record older than a queued record read here is seen too.
+	queued_.clear();
+	for (auto& queue : queues_) {
+		for (auto record = queue->read(); !record.empty(); record = queue->read()) {
+			queued_.push_back(record);
+		}
+	}
+	// Urgent records held back by the previous pass are still at the front of urgent_.
+	// One behind another thread's reservation that is still being filled would be missed
+	// while a later record of its thread was read above. Such a reservation is only a copy
+	// away from its commit, so the lane is read until it has caught up.
+	for (auto record = priority_->read();; record = priority_->read()) {
+		if (!record.empty()) {
+			urgent_.push_back(record);
+		} else if (priority_->caughtUp()) {
+			break;
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	std::stable_sort(urgent_.begin(), urgent_.end(), [&](auto a, auto b) { return time(a) < time(b); });
+	// Checked after the lane was read, so a record reserved before an urgent one that was
+	// read is either among queued_ or keeps its queue from being caught up.
+	bool caught_up = std::all_of(queues_.begin(), queues_.end(), [](auto const& queue) { return queue->caughtUp(); });
+
+	// Runs whose window is over are written ahead of this pass's later lines.
+	std::size_t records = repeating_.empty() ? 0 : flushRepeats(false);
+	if (RateLimit limit = rate_limit_.load(); limit.enabled()) {
+		records += writeSummaries(limit);
+	}
+
+	// Each urgent record is written before the first later record of the other queues.
+	auto next = urgent_.begin();
+	for (auto record : queued_) {
+		for (; next != urgent_.end() && time(*next) <= time(record); ++next) {
+			writeRecord(*next);
+		}
+		writeRecord(record);
+	}
+	records += queued_.size();
+	// A queue that stopped early may still hold older records, e.g. of the thread that
+	// logged the urgent one, so the rest waits for a later pass unless shutting down.
+	bool hold = !caught_up && next != urgent_.end() && !closed_.load(std::memory_order_acquire);
+	if (!hold) {
+		for (; next != urgent_.end(); ++next) {
+			writeRecord(*next);
+		}
+	}
+	records += next - urgent_.begin();
+	urgent_.erase(urgent_.begin(), next);
+	// Other processes' records, with the time order kept only within this queue.
+	// A reservation of a producer that died before committing it is stepped over.
+	if (shared_ && !producer_) {
+		auto& shared = shared_->queue();
+		do {
+			for (auto record = shared.read(); !record.empty(); record = shared.read()) {
+				writeRecord(record);
+				++records;
+			}
+		} while (!shared.caughtUp() && shared_->skipAbandoned());
+	}
+	if (!repeating_.empty() && closed_.load(std::memory_order_acquire)) {
+		// Once shutting down, runs end with the pass instead of their window.
+		records += flushRepeats(true);
+	}
+
+	bool drained = records != 0;
+	if (drained) {
+		// The iovecs point into the queues, which are released once the writes completed.
+		io_->writevBorrowed(iovecs_.data(), iovecs_.size());
+		if (!io_->submit()) {
+			// Which of the pass's writes completed is not known, so all of them count.
+			unpersisted_ += records;
+			if (io_->abandoned()) {
+				// Nothing can be released any more, so producers would wait for room forever.
+				fprintf(stderr, "The log stopped writing, its records are dropped from now on\n");
+				abandoned_ = true;
+				closed_.store(true, std::memory_order_release);
+				completeFlushes(true);
+				return true;
+			}
+		}
+		iovecs_.clear();
+		repeat_lines_.clear();
+		if (index_) {
+			index_->flush();
+		}
+		if (urgent_.empty()) {
+			// Held back records live in the lane, so it is released once they are written.
+			priority_->release();
+		}
+		for (auto& queue : queues_) {
+			queue->release();
+		}
+		if (shared_ && !producer_) {
+			shared_->queue().release();
+		}
+	}
+	completeFlushes(false);
+	return drained;
+}
+
+std::size_t logging::Log::discardQueued() {
+	std::lock_guard lock(drain_mutex_);
+	std::size_t records = 0;
+	auto discard = [&](Queue& queue) {
+		for (auto record = queue.read(); !record.empty(); record = queue.read()) {
+			++records;
+		}
+		if (!abandoned_) {
+			queue.release();
+		}
+	};
+	discard(*priority_);
+	for (auto& queue : queues_) {
+		discard(*queue);
+	}
+	if (shared_) {
+		discard(shared_->queue());
+	}
+	return records;
+}
+
+void logging::Log::writeRecord(std::span<char> slot) {
+	auto const& record = *reinterpret_cast<Record const*>(slot.data());
+	if (record.site != 0 && repeat_window_.load(std::memory_order_relaxed) != 0 && collapseRepeat(slot)) {
+		return;
+	}
+	char* text = slot.data() + sizeof(Record);
+	std::size_t size = slot.size() - sizeof(Record);
+
+	auto const& tag = loggers_[record.logger]->tag_;
+	if (index_) {
+		index_->add(record.time, size + tag.size());
+	}
+	if (tag.empty()) {
+		iovecs_.push_back({text, size});
+		return;
+	}
+
+	iovecs_.push_back({text, record.prefixSize});
+	iovecs_.push_back({const_cast<char*>(tag.data()), tag.size()});
+	iovecs_.push_back({text + record.prefixSize, size - record.prefixSize});
+}
+
+bool logging::Log::collapseRepeat(std::span<char> slot) {
+	auto const& record = *reinterpret_cast<Record const*>(slot.data());
+	std::size_t index = record.site & (kRepeatSlots - 1);
+	RepeatRun& run = repeat_runs_[index];
+
+	// The logger and everything after the prefix have to match, the time and thread may differ.
+	if (!run.line.empty()) {
+		auto const& first = *reinterpret_cast<Record const*>(run.line.data());
+		std::string_view text(slot.data() + sizeof(Record) + record.prefixSize, slot.size() - sizeof(Record) - record.prefixSize);
+		std::string_view first_text = std::string_view(run.line).substr(sizeof(Record) + first.prefixSize);
+		if (first.site == record.site && first.logger == record.logger && text == first_text && record.time - first.time < repeat_window_.load(std::memory_order_relaxed)) {
+			if (run.repeats++ == 0) {
+				repeating_.push_back(index);
+			}
+			run.last = record.time;
+			return true;
+		}
+	}
+
+	if (run.repeats != 0) {
+		writeRepeats(run);
+	}
+	run.line.assign(slot.data(), slot.size());
+	return false;
+}
+
+void logging::Log::writeRepeats(RepeatRun& run) {
+	// "<time of the last repeat> <thread and logger of the first line> basename:line [level] repeated N times"
+	auto const& first = *reinterpret_cast<Record const*>(run.line.data());
+	char const* text = run.line.data() + sizeof(Record);
+
+	fmt::memory_buffer buffer;
+	Record record = first;
+	record.site = 0;
+	record.time = run.last;
+	buffer.append(reinterpret_cast<char const*>(&record), reinterpret_cast<char const*>(&record) + sizeof(Record));
+	appendTime(buffer, run.last);
+	buffer.append(text + kTimeSize, text + first.prefixSize + first.siteSize);
+	fmt::format_to(std::back_inserter(buffer), "repeated {} times\n", run.repeats);
+	run.repeats = 0;
+
+	auto& line = repeat_lines_.emplace_back(buffer.data(), buffer.size());
+	writeRecord({line.data(), line.size()});
+}
+
+std::size_t logging::Log::flushRepeats(bool all) {
+	const int64_t time = now();
+	const int64_t window = repeat_window_.load(std::memory_order_relaxed);
+	std::size_t written = 0;
+	std::erase_if(repeating_, [&](std::size_t index) {
+		RepeatRun& run = repeat_runs_[index];
+		if (run.repeats == 0) {
+			return true;
+		}
+		auto const& first = *reinterpret_cast<Record const*>(run.line.data());
+		if (!all && time - first.time < window) {
+			return false;
+		}
+		writeRepeats(run);
+		// The next identical line starts a new run rather than extending this one.
+		run.line.clear();
+		++written;
+		return true;
+	});
+	return written;
+}
+
+void logging::Log::addSuppressedSummary(uint16_t logger, logging::LogLevel level, CallSite& site, uint64_t suppressed) {
+	fmt::memory_buffer buffer;
+	Record record = renderSummary(buffer, logger, level, site, suppressed);
+	enqueue(record, {buffer.data(), buffer.size()});
+}
+
+logging::Record logging::Log::renderSummary(fmt::memory_buffer& buffer, uint16_t logger, logging::LogLevel level, CallSite& site, uint64_t suppressed) {
+	auto time = appendPrefix(buffer);
+	auto prefix_size = buffer.size();
+	appendSite(buffer, site.location(), level);
+	fmt::format_to(std::back_inserter(buffer), "suppressed {} messages\n", suppressed);
+	return Record{logger, static_cast<uint16_t>(prefix_size), level, 0, 0, time};
+}
+
+std::size_t logging::Log::writeSummaries(RateLimit const& limit) {
+	// Sites that went quiet would otherwise report only once they log again, or at shutdown.
+	// The writer cannot enqueue, it would wait for room only it makes, so it writes the
+	// lines itself like the repeat lines.
+	const int64_t time = now();
+	if (time < next_summary_sweep_) {
+		return 0;
+	}
+	next_summary_sweep_ = time + kSummarySweepInterval;
+
+	std::size_t written = 0;
+	call_sites_.forEach([&](CallSite& site) {
+		if (auto suppressed = site.takeSuppressed(limit)) {
+			fmt::memory_buffer buffer;
+			Record record = renderSummary(buffer, 0, logging::LogLevel::info, site, suppressed);
+			auto& line = repeat_lines_.emplace_back(reinterpret_cast<char const*>(&record), sizeof(Record));
+			line.append(buffer.data(), buffer.size());
+			writeRecord({line.data(), line.size()});
+			++written;
+		}
+	});
+	return written;
+}
+
+void logging::Log::setThreadName(std::string_view name) {
+	renderThreadTag(name);
+
+	// The kernel keeps at most 15 characters, enough for top and perf to show it.
+	char comm[16]{};
+	memcpy(comm, name.data(), std::min(name.size(), sizeof(comm) - 1));
+	pthread_setname_np(pthread_self(), comm);
+}
+
+fmt::memory_buffer& logging::Log::threadBuffer() {
+	thread_local fmt::memory_buffer buffer;
+	return buffer;
+}
+
+int64_t logging::Log::now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int64_t logging::Log::appendPrefix(fmt::memory_buffer& buffer) {
+    // Get current time
+    auto ns = now();
+    appendPrefix(buffer, ns);
+    return ns;
+}
+
+void logging::Log::appendPrefix(fmt::memory_buffer& buffer, int64_t ns) {
+    appendTime(buffer, ns);
+
+    // The cached thread tag is appended as is
+    auto tag = threadTag();
+    buffer.append(tag.data(), tag.data() + tag.size());
+}
+
+void logging::Log::appendTime(fmt::memory_buffer& buffer, int64_t ns) {
+    std::time_t time = ns / 1000000000;
+
+    // The date and time only change once a second, so they are rendered once per second and
+    // thread, and every line only converts its nanoseconds.
+    struct DateTime {
+        std::time_t second = -1;
+        char text[20];
+    };
+    thread_local DateTime date_time;
+    if (date_time.second != time) {
+        std::tm tm;
+        localtime_r(&time, &tm);
+        fmt::format_to_n(date_time.text, sizeof(date_time.text), "{:%Y-%m-%d %H:%M:%S}.", tm);
+        date_time.second = time;
+    }
+
+    std::size_t size = buffer.size();
+    buffer.resize(size + sizeof(date_time.text) + 10);
+    char* p = buffer.data() + size;
+    memcpy(p, date_time.text, sizeof(date_time.text));
+    p = digits::writeDecimalPadded(p + sizeof(date_time.text), ns % 1000000000, 9);
+    *p = ' ';
 }
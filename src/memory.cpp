@@ -0,0 +1,103 @@
+#include "log/memory.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+namespace {
+    constexpr std::size_t kHugePageSize = 2 << 20;
+
+    std::size_t mappedSize(std::size_t bytes, logging::MemoryOptions const& options) {
+        if (options.hugePages == logging::HugePages::None) {
+            return bytes;
+        }
+        return (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+
+    // Over-maps by one huge page and trims both ends, so the region starts on a boundary
+    // transparent huge pages can use.
+    void* mapAligned(std::size_t bytes) {
+        void* raw = mmap(nullptr, bytes + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            return MAP_FAILED;
+        }
+        auto start = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        if (aligned != start) {
+            munmap(raw, aligned - start);
+        }
+        if (std::size_t tail = start + kHugePageSize - aligned; tail != 0) {
+            munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+        }
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void prefault(void* ptr, std::size_t bytes) {
+        // Kernels before 5.14 do not know the advice, one store per page does the same.
+        if (madvise(ptr, bytes, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        for (std::size_t offset = 0; offset < bytes; offset += page) {
+            static_cast<volatile char*>(ptr)[offset] = 0;
+        }
+    }
+}
+
+void* logging::allocatePages(std::size_t bytes, MemoryOptions const& options) {
+    const std::size_t length = mappedSize(bytes, options);
+
+    void* ptr = MAP_FAILED;
+    if (options.hugePages == HugePages::Explicit) {
+        ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        if (options.hugePages == HugePages::None) {
+            ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            ptr = mapAligned(length);
+            if (ptr != MAP_FAILED) {
+                madvise(ptr, length, MADV_HUGEPAGE);
+            }
+        }
+    }
+    if (ptr == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+
+    if (options.node >= 0) {
+        // Preferred rather than bound, a full node falls back to its neighbours. Placement
+        // is a hint, so a kernel without NUMA support is not an error.
+        unsigned long mask[4] = {};
+        if (options.node < static_cast<int>(sizeof(mask) * 8)) {
+            mask[options.node / 64] = 1ul << (options.node % 64);
+            syscall(SYS_mbind, ptr, length, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+        }
+    }
+
+    // After mbind, so the pages are faulted in on the preferred node.
+    if (options.prefault) {
+        prefault(ptr, length);
+    }
+    if (options.lock && mlock(ptr, length) != 0) {
+        fprintf(stderr, "Failed to lock log memory: %s\n", strerror(errno));
+    }
+    return ptr;
+}
+
+void logging::freePages(void* ptr, std::size_t bytes, MemoryOptions const& options) noexcept {
+    if (ptr) {
+        munmap(ptr, mappedSize(bytes, options));
+    }
+}
@@ -0,0 +1,135 @@
+#include "log/mmap_engine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+logging::MmapEngine::~MmapEngine() {
+    unmap();
+    if (fd_ != -1) {
+        // The blocks reserved for the rest of the window.
+        uint64_t end = (size_ + kBlockSize - 1) / kBlockSize * kBlockSize;
+        if (window_end_ > end) {
+            fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, end, window_end_ - end);
+        }
+        if (ftruncate(fd_, size_) != 0) {
+            std::cerr << "Failed to truncate the log file: " << strerror(errno) << std::endl;
+        }
+        close(fd_);
+    }
+}
+
+int logging::MmapEngine::register_file(std::string_view file_path) {
+    std::lock_guard lock(mutex_);
+    fd_ = open(std::string(file_path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd_ == -1) {
+        std::cerr << "Error opening file" << std::endl;
+        return 1;
+    }
+    struct stat st;
+    size_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+
+    if (!map(size_ == 0 ? 0 : size_ - 1)) {
+        return 1;
+    }
+    // A process that died with a window mapped left zeros after its last record.
+    while (size_ > base_ && window_[size_ - 1 - base_] == 0) {
+        --size_;
+    }
+    return 0;
+}
+
+void logging::MmapEngine::writev(const struct iovec* parts, int num_parts) {
+    writevBorrowed(parts, num_parts);
+}
+
+void logging::MmapEngine::writevBorrowed(const struct iovec* parts, int num_parts) {
+    std::lock_guard lock(mutex_);
+    if (fd_ == -1) {
+        return;
+    }
+    uint64_t left = 0;
+    for (int i = 0; i < num_parts; ++i) {
+        left += parts[i].iov_len;
+    }
+
+    const char* data = nullptr;
+    size_t len = 0;
+    while (left != 0) {
+        if (!window_) {
+            // A window that could not be mapped loses the rest.
+            failed_ = true;
+            return;
+        }
+        if (size_ == base_ + kWindowSize) {
+            unmap();
+            if (!map(size_)) {
+                failed_ = true;
+                return;
+            }
+        }
+
+        // The file is grown to the end of the stores before they are made: pages past the
+        // end would fault, and readers see no more than the records written.
+        uint64_t end = std::min<uint64_t>(size_ + left, base_ + kWindowSize);
+        if (ftruncate(fd_, end) != 0) {
+            std::cerr << "Failed to extend the log file: " << strerror(errno) << std::endl;
+            failed_ = true;
+            return;
+        }
+        while (size_ != end) {
+            if (len == 0) {
+                data = static_cast<const char*>(parts->iov_base);
+                len = parts->iov_len;
+                ++parts;
+                continue;
+            }
+            size_t chunk = std::min<uint64_t>(len, end - size_);
+            memcpy(window_ + (size_ - base_), data, chunk);
+            size_ += chunk;
+            data += chunk;
+            len -= chunk;
+            left -= chunk;
+        }
+    }
+}
+
+bool logging::MmapEngine::submit() {
+    std::lock_guard lock(mutex_);
+    return !std::exchange(failed_, false);
+}
+
+bool logging::MmapEngine::map(uint64_t offset) {
+    base_ = offset / kWindowSize * kWindowSize;
+
+    // Reserves the window's blocks without growing the file. Without fallocate the file
+    // is sparse and a full disk faults the store instead.
+    if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, base_, kWindowSize) != 0 && errno != EOPNOTSUPP) {
+        std::cerr << "Failed to allocate the log file: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    void* window = mmap(nullptr, kWindowSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, base_);
+    if (window == MAP_FAILED) {
+        std::cerr << "Failed to map the log file: " << strerror(errno) << std::endl;
+        return false;
+    }
+    window_end_ = base_ + kWindowSize;
+    window_ = static_cast<char*>(window);
+    return true;
+}
+
+void logging::MmapEngine::unmap() {
+    if (window_) {
+        munmap(window_, kWindowSize);
+        window_ = nullptr;
+    }
+}
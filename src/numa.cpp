@@ -0,0 +1,77 @@
+#include "log/numa.h"
+
+#include <fstream>
+#include <string>
+
+#include <sched.h>
+
+namespace {
+    // Parses the kernel's list format, e.g. "0-3,8,10-11".
+    std::vector<int> parseList(std::string const& list) {
+        std::vector<int> result;
+        std::size_t pos = 0;
+        while (pos < list.size()) {
+            std::size_t end = list.find(',', pos);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+            auto range = list.substr(pos, end - pos);
+            if (!range.empty()) {
+                std::size_t dash = range.find('-');
+                int first = std::stoi(range.substr(0, dash));
+                int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int i = first; i <= last; ++i) {
+                    result.push_back(i);
+                }
+            }
+            pos = end + 1;
+        }
+        return result;
+    }
+
+    std::string readLine(std::string const& path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+}
+
+logging::NumaTopology const& logging::NumaTopology::get() {
+    static const NumaTopology topology;
+    return topology;
+}
+
+logging::NumaTopology::NumaTopology() {
+    try {
+        for (int node : parseList(readLine("/sys/devices/system/node/online"))) {
+            auto cpus = parseList(readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+            if (cpus.empty()) {
+                // Memory-only nodes never run producers.
+                continue;
+            }
+            for (int cpu : cpus) {
+                if (cpu >= static_cast<int>(cpu_to_index_.size())) {
+                    cpu_to_index_.resize(cpu + 1, 0);
+                }
+                cpu_to_index_[cpu] = static_cast<int>(nodes_.size());
+            }
+            nodes_.push_back(node);
+        }
+    } catch (...) {
+        nodes_.clear();
+    }
+
+    if (nodes_.size() <= 1) {
+        nodes_.assign(1, -1);
+        cpu_to_index_.clear();
+    }
+}
+
+std::size_t logging::NumaTopology::currentIndex() const noexcept {
+    if (cpu_to_index_.empty()) {
+        return 0;
+    }
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < static_cast<int>(cpu_to_index_.size()) ? cpu_to_index_[cpu] : 0;
+}
@@ -0,0 +1,155 @@
+#include "log/pipe_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+    // Pipes have no MSG_NOSIGNAL, so SIGPIPE is held back on the calling thread and a
+    // signal raised by the call is taken off again before it is unblocked.
+    ssize_t sendQuietly(int fd, struct iovec const* parts, int num_parts, bool by_reference) {
+        sigset_t pipe, old;
+        sigemptyset(&pipe);
+        sigaddset(&pipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe, &old);
+
+        ssize_t result = by_reference ? vmsplice(fd, parts, num_parts, SPLICE_F_NONBLOCK) : writev(fd, parts, num_parts);
+        if (result == -1 && errno == EPIPE) {
+            const struct timespec zero{};
+            sigtimedwait(&pipe, nullptr, &zero);
+            errno = EPIPE;
+        }
+
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        return result;
+    }
+}
+
+logging::PipeSink::PipeSink(int fd, Deadline const& deadline) : fd_(fd), deadline_(deadline) {
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+    // Room for a few passes, so the writer waits on the reader only when it lags. Every
+    // spliced part takes a slot, so the slots run out before the bytes do.
+    fcntl(fd_, F_SETPIPE_SZ, static_cast<int>(kPipeSize));
+}
+
+logging::PipeSink::~PipeSink() {
+    if (dropped_ != 0) {
+        fprintf(stderr, "The log pipe was closed or stalled, %lu bytes were dropped\n", static_cast<unsigned long>(dropped_));
+    }
+}
+
+void logging::PipeSink::write(const struct iovec* parts, int num_parts) {
+    send(parts, num_parts, false);
+}
+
+void logging::PipeSink::splice(const struct iovec* parts, int num_parts) {
+    // Runs of short parts are copied in one call, long parts are spliced in the next.
+    while (num_parts > 0) {
+        bool by_reference = parts->iov_len >= kSpliceMin;
+        int run = 1;
+        while (run < num_parts && (parts[run].iov_len >= kSpliceMin) == by_reference) {
+            ++run;
+        }
+        send(parts, run, by_reference);
+        if (by_reference) {
+            spliced_ = written_;
+        }
+        parts += run;
+        num_parts -= run;
+    }
+}
+
+bool logging::PipeSink::consumed() {
+    // The pipe keeps its bytes in order, so the spliced ones are gone once fewer than
+    // those written after them are left unread.
+    for (int spins = 0; !broken_ && !abandoned_; ++spins) {
+        int unread = 0;
+        if (ioctl(fd_, FIONREAD, &unread) != 0 || written_ - unread >= spliced_) {
+            return true;
+        }
+        if (deadline_.passed()) {
+            fprintf(stderr, "Gave up waiting for the log pipe's reader at the deadline\n");
+            abandoned_ = true;
+            break;
+        }
+        if (spins < 16) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    // Without a reader the pipe's pages are read by no one.
+    return !abandoned_;
+}
+
+void logging::PipeSink::send(const struct iovec* parts, int num_parts, bool by_reference) {
+    // A short write leaves the rest to a copy of the parts, trimmed in place from then on.
+    std::vector<struct iovec> rest;
+    while (num_parts > 0) {
+        int chunk = std::min(num_parts, IOV_MAX);
+        if (broken_ || abandoned_) {
+            for (int i = 0; i < num_parts; ++i) {
+                dropped_ += parts[i].iov_len;
+            }
+            return;
+        }
+
+        ssize_t written = sendQuietly(fd_, parts, chunk, by_reference);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                broken_ = !waitWritable();
+                continue;
+            }
+            fprintf(stderr, "Failed to write to the log pipe: %s\n", strerror(errno));
+            broken_ = true;
+            continue;
+        }
+        written_ += written;
+
+        while (num_parts > 0 && static_cast<size_t>(written) >= parts->iov_len) {
+            written -= parts->iov_len;
+            ++parts;
+            --num_parts;
+        }
+        if (written != 0) {
+            if (rest.empty()) {
+                rest.assign(parts, parts + num_parts);
+                parts = rest.data();
+            }
+            auto first = const_cast<struct iovec*>(parts);
+            first->iov_base = static_cast<char*>(first->iov_base) + written;
+            first->iov_len -= written;
+        }
+    }
+}
+
+bool logging::PipeSink::waitWritable() {
+    // Polls in slices, so a deadline set while waiting is noticed within one of them.
+    while (!deadline_.passed()) {
+        struct pollfd pfd = {fd_, POLLOUT, 0};
+        int ready = poll(&pfd, 1, 100);
+        if (ready > 0) {
+            // POLLERR means the reader is gone and nothing will ever be consumed.
+            return !(pfd.revents & (POLLERR | POLLNVAL));
+        }
+        if (ready == -1 && errno != EINTR) {
+            return false;
+        }
+    }
+    fprintf(stderr, "Gave up waiting for the log pipe's reader at the deadline\n");
+    return false;
+}
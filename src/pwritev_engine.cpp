@@ -0,0 +1,76 @@
+#include "log/pwritev_engine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+logging::PwritevEngine::~PwritevEngine() {
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+int logging::PwritevEngine::register_file(std::string_view file_path) {
+    std::lock_guard lock(mutex_);
+    // O_APPEND, so other processes appending to the same file are not overwritten.
+    fd_ = open(std::string(file_path).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd_ == -1) {
+        std::cerr << "Error opening file" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+void logging::PwritevEngine::writev(const struct iovec* parts, int num_parts) {
+    writevBorrowed(parts, num_parts);
+}
+
+void logging::PwritevEngine::writevBorrowed(const struct iovec* parts, int num_parts) {
+    std::lock_guard lock(mutex_);
+    if (fd_ == -1) {
+        return;
+    }
+
+    // Short writes resume from a copy of the remaining parts.
+    std::vector<struct iovec> rest;
+    while (num_parts > 0) {
+        ssize_t written = ::writev(fd_, parts, std::min(num_parts, IOV_MAX));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Failed to write the log file: " << strerror(errno) << std::endl;
+            failed_ = true;
+            return;
+        }
+
+        while (num_parts > 0 && static_cast<size_t>(written) >= parts->iov_len) {
+            written -= parts->iov_len;
+            ++parts;
+            --num_parts;
+        }
+        if (written != 0) {
+            if (rest.empty()) {
+                rest.assign(parts, parts + num_parts);
+                parts = rest.data();
+            }
+            struct iovec& part = rest[parts - rest.data()];
+            part.iov_base = static_cast<char*>(part.iov_base) + written;
+            part.iov_len -= written;
+        }
+    }
+}
+
+bool logging::PwritevEngine::submit() {
+    std::lock_guard lock(mutex_);
+    return !std::exchange(failed_, false);
+}
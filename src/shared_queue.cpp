@@ -0,0 +1,160 @@
+#include "log/shared_queue.h"
+
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct logging::SharedQueue::Header {
+    char magic[8];
+    uint64_t capacity;
+    // Set by the creator once the rest of the header is in place.
+    std::atomic<uint32_t> ready;
+    // Process id of the writer, 0 before one registered and -1 once it detached.
+    std::atomic<int32_t> writer;
+    alignas(64) ::detail::Futex<> sleeping;
+    QueueControl control;
+};
+
+namespace {
+    constexpr char kMagic[8] = "LOGSHQ2";
+
+    // Gives a creating process up to a second to size and fill in the header.
+    template <typename Done>
+    bool waitFor(Done&& done) {
+        for (int i = 0; i < 1000; ++i) {
+            if (done()) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return done();
+    }
+
+    std::runtime_error failure(char const* what) {
+        return std::runtime_error(std::string(what) + ": " + strerror(errno));
+    }
+}
+
+logging::SharedQueue::SharedQueue(SharedOptions const& options)
+    : writer_(options.role == SharedRole::Writer), full_wait_(options.fullWait), pid_(getpid()) {
+    const std::size_t capacity = std::bit_ceil(std::max<std::size_t>(options.capacity, 64));
+    // The ring starts on its own page after the header.
+    const std::size_t ring_offset = (sizeof(Header) + 4095) / 4096 * 4096;
+    mapped_ = ring_offset + capacity;
+
+    const std::string& path = options.name;
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    const bool creator = fd != -1;
+    if (!creator) {
+        if (errno != EEXIST || (fd = shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0)) == -1) {
+            throw failure("Failed to open the shared log queue");
+        }
+    }
+
+    if (creator) {
+        // ftruncate zero-fills, which is the empty ring Queue expects.
+        if (ftruncate(fd, mapped_) != 0) {
+            auto error = failure("Failed to size the shared log queue");
+            close(fd);
+            shm_unlink(path.c_str());
+            throw error;
+        }
+    } else {
+        struct stat st{};
+        if (!waitFor([&] { return fstat(fd, &st) == 0 && st.st_size != 0; }) || static_cast<std::size_t>(st.st_size) != mapped_) {
+            close(fd);
+            throw std::runtime_error("The shared log queue has a different capacity");
+        }
+    }
+
+    void* memory = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw failure("Failed to map the shared log queue");
+    }
+    header_ = static_cast<Header*>(memory);
+
+    if (creator) {
+        new (header_) Header{};
+        memcpy(header_->magic, kMagic, sizeof(kMagic));
+        header_->capacity = capacity;
+        header_->ready.store(1, std::memory_order_release);
+    } else if (!waitFor([&] { return header_->ready.load(std::memory_order_acquire) != 0; }) ||
+               memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 || header_->capacity != capacity) {
+        munmap(header_, mapped_);
+        throw std::runtime_error("The shared log queue is not a log queue of this capacity");
+    }
+
+    queue_ = std::make_unique<Queue>(header_->control, static_cast<char*>(memory) + ring_offset, capacity);
+    if (writer_) {
+        header_->writer.store(pid_, std::memory_order_release);
+    }
+}
+
+logging::SharedQueue::~SharedQueue() {
+    if (writer_) {
+        int32_t self = pid_;
+        header_->writer.compare_exchange_strong(self, -1, std::memory_order_acq_rel);
+    }
+    queue_.reset();
+    munmap(header_, mapped_);
+}
+
+void logging::SharedQueue::remove(std::string_view name) {
+    shm_unlink(std::string(name).c_str());
+}
+
+::detail::Futex<>& logging::SharedQueue::sleeping() noexcept {
+    return header_->sleeping;
+}
+
+void logging::SharedQueue::notify() noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->sleeping.load(std::memory_order_relaxed) != 0 && header_->sleeping.exchange(0, std::memory_order_acq_rel) != 0) {
+        ::detail::futexWake(&header_->sleeping, 1, -1, true);
+    }
+}
+
+char* logging::SharedQueue::reserve(std::size_t size) {
+    auto give_up = std::chrono::steady_clock::time_point::max();
+    char* slot;
+    while (!(slot = queue_->tryReserve(size, pid_))) {
+        // Once a wait ran out, records are dropped without one until there is room again.
+        if (overflowing_.load(std::memory_order_relaxed)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (give_up == std::chrono::steady_clock::time_point::max()) {
+            give_up = now + full_wait_;
+        }
+        if (now >= give_up || writerGone()) {
+            overflowing_.store(true, std::memory_order_relaxed);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        notify();
+        std::this_thread::yield();
+    }
+    if (overflowing_.load(std::memory_order_relaxed)) {
+        overflowing_.store(false, std::memory_order_relaxed);
+    }
+    return slot;
+}
+
+bool logging::SharedQueue::writerGone() const noexcept {
+    const int32_t pid = header_->writer.load(std::memory_order_acquire);
+    return pid == -1 || (pid > 0 && kill(pid, 0) == -1 && errno == ESRCH);
+}
+
+bool logging::SharedQueue::skipAbandoned() {
+    return queue_->skipAbandoned([](uint32_t owner) { return kill(static_cast<pid_t>(owner), 0) == -1 && errno == ESRCH; });
+}
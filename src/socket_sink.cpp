@@ -0,0 +1,256 @@
+#include "log/socket_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <limits.h>
+#include <unistd.h>
+
+namespace {
+    constexpr unsigned kDepth = 64;
+    constexpr uint64_t kConnect = UINT64_MAX;
+
+    bool endsRecord(struct iovec const& part) {
+        return part.iov_len != 0 && static_cast<const char*>(part.iov_base)[part.iov_len - 1] == '\n';
+    }
+
+    std::size_t recordsIn(struct msghdr const& header) {
+        std::size_t records = 0;
+        for (std::size_t i = 0; i < header.msg_iovlen; ++i) {
+            records += endsRecord(header.msg_iov[i]);
+        }
+        return std::max<std::size_t>(records, 1);
+    }
+
+    // The peer is gone or was never there, anything else only loses the one message.
+    bool lostPeer(int error) {
+        return error == EPIPE || error == ECONNREFUSED || error == ECONNRESET || error == ENOTCONN ||
+               error == ENOENT || error == EBADF;
+    }
+}
+
+logging::SocketSink::SocketSink(std::string_view path, SocketOptions options, Deadline const& deadline)
+    : deadline_(deadline), options_(options) {
+    if (path.size() >= sizeof(address_.sun_path)) {
+        throw std::runtime_error("Log socket path is too long");
+    }
+    address_.sun_family = AF_UNIX;
+    memcpy(address_.sun_path, path.data(), path.size());
+    address_size_ = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+
+    if (const int result = io_uring_queue_init(kDepth, &ring_, 0); result != 0) {
+        throw std::runtime_error("Failed to invoke 'io_uring_queue_init'");
+    }
+
+    // Only the first connect is waited for, so records logged right away are not dropped.
+    connect();
+    reapConnect(true);
+    if (state_ != State::Connected) {
+        fprintf(stderr, "Failed to connect to the log socket, retrying in the background\n");
+    }
+}
+
+logging::SocketSink::~SocketSink() {
+    flush();
+    reapConnect(true);
+    if (fd_ != -1) {
+        close(fd_);
+    }
+    io_uring_queue_exit(&ring_);
+}
+
+void logging::SocketSink::send(const struct iovec* parts, int num_parts) {
+    if (abandoned_) {
+        // The batch's vectors may still be read by the kernel, they are left as they are.
+        for (int i = 0; i < num_parts; ++i) {
+            dropped_ += endsRecord(parts[i]);
+        }
+        return;
+    }
+    for (int i = 0; i < num_parts; ++i) {
+        parts_.push_back(parts[i]);
+        if (options_.type == SocketType::Datagram && endsRecord(parts[i])) {
+            messages_.push_back({open_, parts_.size() - open_});
+            open_ = parts_.size();
+        }
+    }
+}
+
+void logging::SocketSink::flush() {
+    if (abandoned_) {
+        return;
+    }
+    if (options_.type == SocketType::Datagram) {
+        if (open_ != parts_.size()) {
+            messages_.push_back({open_, parts_.size() - open_});
+        }
+    } else {
+        for (std::size_t first = 0; first < parts_.size(); first += IOV_MAX) {
+            messages_.push_back({first, std::min<std::size_t>(IOV_MAX, parts_.size() - first)});
+        }
+    }
+
+    reapConnect(false);
+    if (state_ == State::Disconnected && std::chrono::steady_clock::now() >= retry_at_) {
+        connect();
+        reapConnect(false);
+    }
+
+    headers_.assign(messages_.size(), msghdr{});
+    for (std::size_t i = 0; i < messages_.size(); ++i) {
+        headers_[i].msg_iov = parts_.data() + messages_[i].first;
+        headers_[i].msg_iovlen = messages_[i].count;
+    }
+
+    if (state_ == State::Connected) {
+        sendMessages();
+    } else {
+        for (auto const& header : headers_) {
+            dropped_ += recordsIn(header);
+        }
+    }
+
+    parts_.clear();
+    messages_.clear();
+    headers_.clear();
+    open_ = 0;
+}
+
+void logging::SocketSink::sendMessages() {
+    // Messages left to send, a stream socket may take only part of one at a time.
+    std::vector<std::size_t> pending(headers_.size());
+    for (std::size_t i = 0; i < pending.size(); ++i) {
+        pending[i] = pending.size() - 1 - i;
+    }
+
+    // Bytes of a stream must not overtake each other, so its messages go one at a time.
+    const unsigned window = options_.type == SocketType::Stream ? 1 : kDepth;
+    std::vector<std::size_t> again;
+    std::vector<std::size_t> in_flight;
+    while (!pending.empty()) {
+        while (in_flight.size() < window && !pending.empty()) {
+            std::size_t index = pending.back();
+            pending.pop_back();
+            if (state_ != State::Connected) {
+                dropped_ += recordsIn(headers_[index]);
+                continue;
+            }
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+            io_uring_prep_sendmsg(sqe, fd_, &headers_[index], MSG_NOSIGNAL);
+            sqe->user_data = index;
+            in_flight.push_back(index);
+        }
+        if (in_flight.empty()) {
+            break;
+        }
+
+        io_uring_submit(&ring_);
+        while (!in_flight.empty()) {
+            struct io_uring_cqe* cqe;
+            if (!waitCqe(&cqe)) {
+                for (std::size_t index : in_flight) {
+                    dropped_ += recordsIn(headers_[index]);
+                }
+                for (std::size_t index : pending) {
+                    dropped_ += recordsIn(headers_[index]);
+                }
+                return;
+            }
+            const int res = cqe->res;
+            const uint64_t index = cqe->user_data;
+            io_uring_cqe_seen(&ring_, cqe);
+            in_flight.erase(std::find(in_flight.begin(), in_flight.end(), index));
+
+            struct msghdr& header = headers_[index];
+            if (res < 0) {
+                if (lostPeer(-res) && state_ == State::Connected) {
+                    disconnect(-res);
+                }
+                dropped_ += recordsIn(header);
+                continue;
+            }
+
+            // Skips what was sent and queues the rest again.
+            std::size_t sent = res;
+            while (header.msg_iovlen != 0 && sent >= header.msg_iov->iov_len) {
+                sent -= header.msg_iov->iov_len;
+                ++header.msg_iov;
+                --header.msg_iovlen;
+            }
+            if (header.msg_iovlen != 0) {
+                header.msg_iov->iov_base = static_cast<char*>(header.msg_iov->iov_base) + sent;
+                header.msg_iov->iov_len -= sent;
+                again.push_back(index);
+            }
+        }
+        pending.insert(pending.end(), again.rbegin(), again.rend());
+        again.clear();
+    }
+}
+
+void logging::SocketSink::connect() {
+    const int type = options_.type == SocketType::Datagram ? SOCK_DGRAM : SOCK_STREAM;
+    fd_ = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (fd_ == -1) {
+        retry_at_ = std::chrono::steady_clock::now() + options_.reconnectInterval;
+        return;
+    }
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    io_uring_prep_connect(sqe, fd_, reinterpret_cast<struct sockaddr*>(&address_), address_size_);
+    sqe->user_data = kConnect;
+    io_uring_submit(&ring_);
+    state_ = State::Connecting;
+}
+
+void logging::SocketSink::reapConnect(bool wait) {
+    if (state_ != State::Connecting || abandoned_) {
+        return;
+    }
+
+    struct io_uring_cqe* cqe;
+    if (wait ? !waitCqe(&cqe) : io_uring_peek_cqe(&ring_, &cqe) != 0) {
+        return;
+    }
+    const int res = cqe->res;
+    io_uring_cqe_seen(&ring_, cqe);
+
+    if (res != 0) {
+        close(fd_);
+        fd_ = -1;
+        state_ = State::Disconnected;
+        retry_at_ = std::chrono::steady_clock::now() + options_.reconnectInterval;
+        return;
+    }
+
+    state_ = State::Connected;
+    if (dropped_ != 0) {
+        fprintf(stderr, "Reconnected to the log socket, %lu records were dropped\n", static_cast<unsigned long>(dropped_));
+        dropped_ = 0;
+    }
+}
+
+void logging::SocketSink::disconnect(int error) {
+    fprintf(stderr, "Lost the log socket: %s\n", strerror(error));
+    close(fd_);
+    fd_ = -1;
+    state_ = State::Disconnected;
+    // The first attempt is right away, the peer may just have restarted.
+    retry_at_ = std::chrono::steady_clock::now();
+}
+
+bool logging::SocketSink::waitCqe(struct io_uring_cqe** cqe) {
+    if (int result = deadline_.waitCqe(&ring_, cqe); result != 0) {
+        if (result == -ETIME) {
+            fprintf(stderr, "Gave up waiting for the log socket at the deadline\n");
+        } else {
+            fprintf(stderr, "Failed to wait for the log socket: %s\n", strerror(-result));
+        }
+        abandoned_ = true;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+#include "log/time_index.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+logging::TimeIndex::TimeIndex(std::string const& log_path, std::size_t interval) : interval_(interval) {
+    struct stat st;
+    offset_ = stat(log_path.c_str(), &st) == 0 ? st.st_size : 0;
+    next_ = offset_;
+
+    std::string path = log_path + ".idx";
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (fd_ == -1) {
+        fprintf(stderr, "Failed to open the time index %s: %s\n", path.c_str(), strerror(errno));
+        return;
+    }
+
+    // A fresh log gets a fresh index, an appended one keeps adding to the existing index.
+    if (offset_ == 0 && ftruncate(fd_, 0) != 0) {
+        fprintf(stderr, "Failed to truncate the time index: %s\n", strerror(errno));
+    }
+    if (fstat(fd_, &st) == 0 && st.st_size == 0) {
+        TimeIndexHeader header;
+        header.interval = interval_;
+        if (::write(fd_, &header, sizeof(header)) != sizeof(header)) {
+            fprintf(stderr, "Failed to write the time index header: %s\n", strerror(errno));
+        }
+    }
+}
+
+logging::TimeIndex::~TimeIndex() {
+    flush();
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+void logging::TimeIndex::flush() {
+    if (pending_.empty() || fd_ == -1) {
+        pending_.clear();
+        return;
+    }
+
+    std::size_t bytes = pending_.size() * sizeof(TimeIndexEntry);
+    if (::write(fd_, pending_.data(), bytes) != static_cast<ssize_t>(bytes)) {
+        fprintf(stderr, "Failed to write the time index: %s\n", strerror(errno));
+    }
+    pending_.clear();
+}
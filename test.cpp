@@ -1,7 +1,13 @@
 #include "log/log.h"
 #include "simple_logger.hpp"
 #include <fstream>
+#include <thread>
 #include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 // #include "NanoLog.hpp"
 
 using namespace std::chrono_literals;
@@ -13,6 +19,500 @@ inline uint64_t rdtsc() {
     return ((uint64_t)high << 32) | low;
 }
 
+// Times each digit kernel against the fmt call it replaces on the same inputs.
+template <typename Fmt, typename Kernel>
+void benchmarkKernel(const char* name, Fmt&& with_fmt, Kernel&& with_kernel) {
+    constexpr int iterations = 10000000;
+    char out[64];
+    auto time = [&](auto&& f) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            f(out, i);
+            asm volatile("" : : "r"(out) : "memory");
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    };
+    double fmt_ns = time(with_fmt);
+    double kernel_ns = time(with_kernel);
+    std::cout << name << ": fmt " << fmt_ns << " ns, kernel " << kernel_ns << " ns\n";
+}
+
+void benchmarkDigitKernels() {
+    namespace digits = logging::digits;
+    benchmarkKernel("uint64",
+        [](char* out, int i) { fmt::format_to(out, "{}", 1234567890123ull * i); },
+        [](char* out, int i) { digits::writeDecimal(out, 1234567890123ull * i); });
+    benchmarkKernel("int32",
+        [](char* out, int i) { fmt::format_to(out, "{}", i - 5000000); },
+        [](char* out, int i) { digits::writeDecimal(out, i - 5000000); });
+    benchmarkKernel("nanoseconds {:09d}",
+        [](char* out, int i) { fmt::format_to(out, "{:09d}", i * 97); },
+        [](char* out, int i) { digits::writeDecimalPadded(out, i * 97, 9); });
+    benchmarkKernel("hex",
+        [](char* out, int i) { fmt::format_to(out, "{:x}", 0x7ffc53830fbcull + i * 64); },
+        [](char* out, int i) { digits::writeHex(out, 0x7ffc53830fbcull + i * 64); });
+    benchmarkKernel("double",
+        [](char* out, int i) { fmt::format_to(out, "{}", i * 0.37); },
+        [](char* out, int i) { digits::writeFloating(out, i * 0.37); });
+}
+
+// Runs the same multi-threaded workload through every output engine.
+void benchmarkEngines() {
+    constexpr int threads = 4;
+    constexpr int messages = 250000;
+    const std::pair<const char*, logging::IoEngineKind> engines[] = {
+        {"io_uring", logging::IoEngineKind::IoUring},
+        {"pwritev", logging::IoEngineKind::Pwritev},
+        {"mmap", logging::IoEngineKind::Mmap},
+    };
+    for (auto [name, kind] : engines) {
+        std::string path = std::string("engine_") + name + ".txt";
+        std::remove(path.c_str());
+
+        logging::IoOptions io;
+        io.engine = kind;
+        logging::Log log(io);
+        log.setTimeIndex(0);
+        log.setOutputFile(path);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&log, t] {
+                for (int i = 0; i < messages; ++i) {
+                    log.info("Worker {} request {} took {} us", t, i, i % 977);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        log.flush().get();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / (threads * messages);
+        std::cout << "engine " << name << ": " << ns << " ns per message\n";
+    }
+}
+
+// Mixes error lines, which take the priority lane, into info lines and checks that every
+// thread's lines are still written in the order it logged them.
+bool checkMixedLevelOrder() {
+    constexpr int threads = 4;
+    constexpr int messages = 50000;
+    const char* path = "order.txt";
+    std::remove(path);
+    {
+        logging::Log log(logging::BackendOptions{});
+        log.setTimeIndex(0);
+        log.setOutputFile(path);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&log, t] {
+                for (int i = 0; i < messages; ++i) {
+                    if (i % 1000 == 0) {
+                        log.error("thread {} i {}", t, i);
+                    } else {
+                        log.info("thread {} i {}", t, i);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    std::ifstream in(path);
+    std::vector<int> last(threads, -1);
+    std::string line;
+    int lines = 0;
+    while (std::getline(in, line)) {
+        int t, i;
+        auto at = line.find("thread ");
+        if (at == std::string::npos || sscanf(line.c_str() + at, "thread %d i %d", &t, &i) != 2 || t < 0 || t >= threads) {
+            continue;
+        }
+        if (i != last[t] + 1) {
+            std::cout << "order: thread " << t << " wrote " << i << " after " << last[t] << "\n";
+            return false;
+        }
+        last[t] = i;
+        ++lines;
+    }
+    bool ok = lines == threads * messages;
+    std::cout << "order: " << lines << " lines, " << (ok ? "in order" : "lines missing") << "\n";
+    return ok;
+}
+
+// A Unix domain socket bound to path, listening when it is a stream socket.
+int bindUnixSocket(const char* path, int type) {
+    unlink(path);
+    int fd = socket(AF_UNIX, type, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if (fd == -1 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        (type == SOCK_STREAM && listen(fd, 4) != 0)) {
+        perror("socket test");
+        return -1;
+    }
+    return fd;
+}
+
+// Receives from fd until lines newlines arrived or nothing came for a second, and returns
+// the newlines seen. Every datagram must hold exactly one line.
+int receiveLines(int fd, int lines, bool datagrams) {
+    char buffer[65536];
+    int seen = 0;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (seen < lines && poll(&pfd, 1, 1000) > 0) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            break;
+        }
+        int newlines = std::count(buffer, buffer + received, '\n');
+        if (datagrams && (newlines != 1 || buffer[received - 1] != '\n')) {
+            std::cout << "socket: datagram without exactly one line\n";
+            return -1;
+        }
+        seen += newlines;
+    }
+    return seen;
+}
+
+// Sends lines through a datagram socket and checks they all arrive, one per datagram.
+bool checkSocketDatagram() {
+    constexpr int messages = 2000;
+    const char* path = "log_test_dgram.sock";
+    int server = bindUnixSocket(path, SOCK_DGRAM);
+    if (server == -1) {
+        return false;
+    }
+    // Large enough for every datagram, so none is dropped before it is read.
+    int size = 8 << 20;
+    setsockopt(server, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    int received = 0;
+    std::thread reader([&] { received = receiveLines(server, messages, true); });
+    {
+        logging::Log log;
+        log.setOutputSocket(path);
+        for (int i = 0; i < messages; ++i) {
+            log.info("datagram {}", i);
+        }
+        log.flush().get();
+    }
+    reader.join();
+    close(server);
+    unlink(path);
+
+    std::cout << "socket datagram: " << received << " of " << messages << " lines\n";
+    return received == messages;
+}
+
+// Sends lines over a stream connection, drops the connection and checks that the sink
+// reconnects and delivers what is logged afterwards.
+bool checkSocketStreamReconnect() {
+    constexpr int messages = 1000;
+    const char* path = "log_test_stream.sock";
+    int server = bindUnixSocket(path, SOCK_STREAM);
+    if (server == -1) {
+        return false;
+    }
+    auto accept_within = [server](int ms) {
+        struct pollfd pfd = {server, POLLIN, 0};
+        return poll(&pfd, 1, ms) > 0 ? accept(server, nullptr, nullptr) : -1;
+    };
+
+    logging::Log log;
+    log.setOutputSocket(path, {logging::SocketType::Stream, std::chrono::milliseconds(0)});
+    int first = accept_within(1000);
+    for (int i = 0; i < messages; ++i) {
+        log.info("stream {}", i);
+    }
+    log.flush().get();
+    int before = first == -1 ? 0 : receiveLines(first, messages, false);
+    close(first);
+
+    // Lines logged while the peer is gone are dropped, and the failed send starts a reconnect.
+    int second = -1;
+    for (int attempt = 0; attempt < 50 && second == -1; ++attempt) {
+        log.info("disconnected {}", attempt);
+        log.flush().get();
+        second = accept_within(20);
+    }
+    for (int i = 0; i < messages; ++i) {
+        log.info("reconnected {}", i);
+    }
+    log.flush().get();
+    int after = second == -1 ? 0 : receiveLines(second, messages, false);
+    close(second);
+    close(server);
+    unlink(path);
+
+    std::cout << "socket stream: " << before << " lines, " << after << " after reconnecting\n";
+    return before == messages && after >= messages;
+}
+
+// The lines of path that contain text.
+int countLines(const char* path, std::string_view text) {
+    std::ifstream in(path);
+    std::string line;
+    int count = 0;
+    while (std::getline(in, line)) {
+        count += line.find(text) != std::string::npos;
+    }
+    return count;
+}
+
+// Splices long records into a pipe nobody reads, so the writer is stuck when shutdown
+// starts, and checks that shutdown gives up at its deadline and counts every record.
+bool checkShutdownDeadline() {
+    constexpr int messages = 100;
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        perror("shutdown test");
+        return false;
+    }
+
+    std::size_t lost;
+    std::chrono::milliseconds took;
+    {
+        logging::Log log(logging::BackendOptions{});
+        log.setOutputPipe(pipe_fds[1]);
+        for (int i = 0; i < messages; ++i) {
+            log.info("stalled {} {}", i, std::string(3000, 'x'));
+        }
+        std::this_thread::sleep_for(50ms);
+        auto start = std::chrono::steady_clock::now();
+        lost = log.shutdown(start + 200ms);
+        took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    std::cout << "shutdown deadline: " << lost << " of " << messages << " lost after " << took.count() << " ms\n";
+    return lost == messages && took < 1s;
+}
+
+// Stops the log with a short deadline while threads keep logging and flushing into it.
+// Meant to run under a sanitizer as well; logging and flushing after shutdown must be
+// harmless, and a flush then resolves at once.
+bool checkShutdownRace() {
+    constexpr int rounds = 20;
+    const char* path = "shutdown_race.txt";
+    for (int round = 0; round < rounds; ++round) {
+        std::remove(path);
+        logging::Log log(logging::BackendOptions{});
+        log.setTimeIndex(0);
+        log.setOutputFile(path);
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 4; ++t) {
+            workers.emplace_back([&log, &stop, t] {
+                for (int i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+                    log.info("thread {} i {}", t, i);
+                    if (i % 1000 == 0) {
+                        log.flush().get();
+                    }
+                }
+            });
+        }
+        std::this_thread::sleep_for(10ms);
+        log.shutdown(std::chrono::steady_clock::now() + 5ms);
+        bool resolved = log.flush().wait_for(0s) == std::future_status::ready;
+        stop = true;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (!resolved) {
+            std::cout << "shutdown race: a flush after shutdown did not resolve\n";
+            return false;
+        }
+    }
+    std::cout << "shutdown race: " << rounds << " rounds\n";
+    return true;
+}
+
+// A site over its rate logs once; the writer reports the rest after the site went quiet.
+bool checkRateLimitSummary() {
+    const char* path = "rate_limit.txt";
+    std::remove(path);
+    logging::Log log(logging::BackendOptions{});
+    log.setTimeIndex(0);
+    log.setOutputFile(path);
+    log.setRateLimit(logging::RateLimit{1, 1, 1, 100});
+    for (int i = 0; i < 1000; ++i) {
+        log.info("burst {}", i);
+    }
+    // The writer sweeps for summaries every 100 ms even when idle.
+    std::this_thread::sleep_for(500ms);
+
+    // A sweep during the burst may split the count over several lines.
+    std::ifstream in(path);
+    int admitted = 0;
+    int suppressed = 0;
+    for (std::string line; std::getline(in, line);) {
+        int count;
+        auto at = line.find("suppressed ");
+        if (at != std::string::npos && sscanf(line.c_str() + at, "suppressed %d messages", &count) == 1) {
+            suppressed += count;
+        } else if (line.find("burst ") != std::string::npos) {
+            ++admitted;
+        }
+    }
+    std::cout << "rate limit: " << admitted << " admitted, " << suppressed << " reported as suppressed\n";
+    return admitted == 1 && suppressed == 999;
+}
+
+// Debug lines below the threshold are kept and written ahead of the next error only.
+bool checkBacktrace() {
+    const char* path = "backtrace.txt";
+    std::remove(path);
+    {
+        logging::Log log;
+        log.setTimeIndex(0);
+        log.setOutputFile(path);
+        log.setLevel(logging::LogLevel::info);
+        log.setBacktrace(4);
+        for (int i = 0; i < 10; ++i) {
+            log.debug("kept {} {}", i, "text");
+        }
+        log.error("failed");
+    }
+
+    std::ifstream in(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) {
+        lines.push_back(line);
+    }
+    bool ok = lines.size() == 5 && lines.back().find("failed") != std::string::npos;
+    for (int i = 0; ok && i < 4; ++i) {
+        ok = lines[i].find(fmt::format("kept {} text", 6 + i)) != std::string::npos;
+    }
+    std::cout << "backtrace: " << lines.size() << " lines, " << (ok ? "last 4 before the error" : "unexpected") << "\n";
+    return ok;
+}
+
+namespace {
+    // Runs eagerly and is never awaited, enough to co_await inside.
+    struct DetachedTask {
+        struct promise_type {
+            DetachedTask get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    DetachedTask flushFromCoroutine(logging::Log& log, const char* path, int expected, std::promise<int>& written) {
+        co_await log.flushAsync();
+        // Logging more than a queue holds once resumed must not wait on the writer.
+        for (int i = 0; i < 50000; ++i) {
+            log.info("resumed {} {}", i, std::string(40, 'y'));
+        }
+        co_await log.flushAsync();
+        written.set_value(countLines(path, "flushed ") == expected ? countLines(path, "resumed ") : -1);
+    }
+}
+
+// Every record logged before a flush is on disk once it resolves, with and without a
+// backend, and once a coroutine awaiting flushAsync is resumed.
+bool checkFlush() {
+    constexpr int messages = 10000;
+    const char* path = "flush.txt";
+    bool ok = true;
+    for (bool threaded : {false, true}) {
+        std::remove(path);
+        auto log = threaded ? std::make_unique<logging::Log>(logging::BackendOptions{}) : std::make_unique<logging::Log>();
+        log->setTimeIndex(0);
+        log->setOutputFile(path);
+        for (int i = 0; i < messages; ++i) {
+            log->info("flushed {}", i);
+        }
+        log->flush().get();
+        int flushed = countLines(path, "flushed ");
+
+        std::promise<int> written;
+        auto resumed = written.get_future();
+        flushFromCoroutine(*log, path, messages, written);
+        int after_resume = resumed.get();
+
+        std::cout << "flush" << (threaded ? " (backend)" : "") << ": " << flushed << " lines, " << after_resume << " after resuming\n";
+        ok = ok && flushed == messages && after_resume == 50000;
+    }
+    return ok;
+}
+
+// Identical lines of one site collapse into the first and a "repeated N times" line.
+bool checkRepeatCollapse() {
+    const char* path = "repeat.txt";
+    std::remove(path);
+    {
+        logging::Log log(logging::BackendOptions{});
+        log.setTimeIndex(0);
+        log.setOutputFile(path);
+        log.setRepeatWindow(10s);
+        for (int i = 0; i < 100; ++i) {
+            log.error("disk full on {}", "/dev/sda");
+        }
+        log.error("disk full on {}", "/dev/sdb");
+    }
+
+    int first = countLines(path, "disk full on /dev/sda");
+    int repeats = countLines(path, "repeated 99 times");
+    int other = countLines(path, "disk full on /dev/sdb");
+    std::cout << "repeats: " << first << " first, " << repeats << " summary, " << other << " other\n";
+    return first == 1 && repeats == 1 && other == 1;
+}
+
+// Producer processes log through shared memory and the writer process persists all of it.
+bool checkSharedMode() {
+    constexpr int producers = 2;
+    constexpr int messages = 20000;
+    const char* name = "/log_test_shared";
+    const char* path = "shared.txt";
+    logging::SharedQueue::remove(name);
+    std::remove(path);
+    {
+        logging::Log writer(logging::SharedOptions{name, logging::SharedRole::Writer, 1 << 16});
+        writer.setTimeIndex(0);
+        writer.setOutputFile(path);
+        std::vector<pid_t> children;
+        for (int p = 0; p < producers; ++p) {
+            pid_t child = fork();
+            if (child == 0) {
+                std::size_t dropped;
+                {
+                    logging::Log log(logging::SharedOptions{name, logging::SharedRole::Producer, 1 << 16, 10s});
+                    for (int i = 0; i < messages; ++i) {
+                        log.info("producer {} i {}", p, i);
+                    }
+                    log.flush().get();
+                    dropped = log.shutdown(std::chrono::steady_clock::time_point::max());
+                }
+                _exit(dropped == 0 ? 0 : 1);
+            }
+            children.push_back(child);
+        }
+        for (pid_t child : children) {
+            int status = 1;
+            waitpid(child, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                std::cout << "shared: a producer dropped records\n";
+            }
+        }
+    }
+    logging::SharedQueue::remove(name);
+
+    int lines = countLines(path, "producer ");
+    std::cout << "shared: " << lines << " of " << producers * messages << " lines\n";
+    return lines == producers * messages;
+}
+
 int main() {
     logging::Log log;
     int user_id = 42;
@@ -86,5 +586,18 @@ int main() {
     //     t.join();
     // }
 
-    return 0;
+    benchmarkDigitKernels();
+    benchmarkEngines();
+
+    bool ok = checkMixedLevelOrder();
+    ok = checkSocketDatagram() && ok;
+    ok = checkSocketStreamReconnect() && ok;
+    ok = checkShutdownDeadline() && ok;
+    ok = checkShutdownRace() && ok;
+    ok = checkRateLimitSummary() && ok;
+    ok = checkBacktrace() && ok;
+    ok = checkFlush() && ok;
+    ok = checkRepeatCollapse() && ok;
+    ok = checkSharedMode() && ok;
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,207 @@
+// log_grep: prints the lines of a log that fall in a time window, optionally only those of
+// one level and containing a pattern. With "<log>.idx" next to the log only the blocks
+// covering the window are scanned.
+//
+//   log_grep [-f FROM] [-t TO] [-l LEVEL] [PATTERN] FILE
+//
+// FROM and TO use the prefix format, "YYYY-MM-DD HH:MM:SS[.nnnnnnnnn]", and may be cut
+// short anywhere, e.g. "2024-05-01 13" for everything from 13:00 on.
+#include "log/time_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    // Length of "YYYY-MM-DD HH:MM:SS.nnnnnnnnn".
+    constexpr std::size_t kTimeSize = 29;
+
+    struct Mapping {
+        const char* data = nullptr;
+        std::size_t size = 0;
+
+        explicit Mapping(std::string const& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1) {
+                return;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (ptr != MAP_FAILED) {
+                    data = static_cast<const char*>(ptr);
+                    size = st.st_size;
+                    madvise(ptr, size, MADV_SEQUENTIAL);
+                }
+            }
+            close(fd);
+        }
+
+        ~Mapping() {
+            if (data) {
+                munmap(const_cast<char*>(data), size);
+            }
+        }
+    };
+
+    // Compares the first and the last byte of the needle at 16 positions at once and only
+    // runs memcmp on positions where both match.
+    const char* findSubstring(const char* p, const char* end, std::string_view needle) {
+        const std::size_t n = needle.size();
+        if (n == 0) {
+            return p;
+        }
+#if defined(__SSE2__)
+        const __m128i first = _mm_set1_epi8(needle.front());
+        const __m128i last = _mm_set1_epi8(needle.back());
+        for (; end - p >= static_cast<std::ptrdiff_t>(n + 15); p += 16) {
+            const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n - 1));
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+            while (mask != 0) {
+                const int bit = __builtin_ctz(mask);
+                if (n <= 2 || memcmp(p + bit + 1, needle.data() + 1, n - 2) == 0) {
+                    return p + bit;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+        return static_cast<const char*>(memmem(p, end - p, needle.data(), n));
+    }
+
+    // Epoch nanoseconds of a local time in the prefix format, missing fields count as 0.
+    int64_t parseTime(std::string const& text) {
+        std::string full = text + std::string("0000-01-01 00:00:00").substr(std::min<std::size_t>(text.size(), 19));
+        struct tm tm{};
+        if (!strptime(full.c_str(), "%Y-%m-%d %H:%M:%S", &tm)) {
+            fprintf(stderr, "log_grep: cannot parse time '%s'\n", text.c_str());
+            exit(2);
+        }
+        tm.tm_isdst = -1;
+        return static_cast<int64_t>(mktime(&tm)) * 1000000000;
+    }
+
+    struct Filter {
+        std::string from;
+        std::string to;
+        std::string level;
+
+        bool matches(std::string_view line) const {
+            if (line.size() < kTimeSize) {
+                return false;
+            }
+            if (!from.empty() && line.substr(0, from.size()) < from) {
+                return false;
+            }
+            if (!to.empty() && line.substr(0, to.size()) > to) {
+                return false;
+            }
+            return level.empty() || findSubstring(line.data(), line.data() + line.size(), level) != nullptr;
+        }
+    };
+
+    // Byte range of the log that can hold lines of the window, widened by one block on each
+    // side since records from different threads are only ordered within a writer batch.
+    std::pair<std::size_t, std::size_t> window(std::string const& path, Mapping const& log, Filter const& filter) {
+        std::pair<std::size_t, std::size_t> range{0, log.size};
+        if (filter.from.empty() && filter.to.empty()) {
+            return range;
+        }
+
+        Mapping index(path + ".idx");
+        logging::TimeIndexHeader header;
+        if (index.size < sizeof(header) || memcmp(index.data, header.magic, sizeof(header.magic)) != 0) {
+            return range;
+        }
+        auto entries = reinterpret_cast<const logging::TimeIndexEntry*>(index.data + sizeof(header));
+        auto count = (index.size - sizeof(header)) / sizeof(logging::TimeIndexEntry);
+        auto begin = entries;
+        auto end = entries + count;
+        auto by_time = [](logging::TimeIndexEntry const& entry, int64_t time) { return entry.time < time; };
+
+        if (!filter.from.empty()) {
+            auto it = std::lower_bound(begin, end, parseTime(filter.from), by_time);
+            it = it - std::min<std::ptrdiff_t>(it - begin, 2);
+            range.first = it == end ? log.size : it->offset;
+        }
+        if (!filter.to.empty()) {
+            // The end of the window is only known to the second, hence the extra second.
+            auto it = std::lower_bound(begin, end, parseTime(filter.to) + 1000000000, by_time);
+            it = it + std::min<std::ptrdiff_t>(end - it, 2);
+            range.second = it == end ? log.size : it->offset;
+        }
+        range.first = std::min(range.first, log.size);
+        range.second = std::clamp(range.second, range.first, log.size);
+        return range;
+    }
+
+    void usage() {
+        fprintf(stderr, "usage: log_grep [-f FROM] [-t TO] [-l LEVEL] [PATTERN] FILE\n");
+        exit(2);
+    }
+}
+
+int main(int argc, char** argv) {
+    Filter filter;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:l:")) != -1) {
+        switch (opt) {
+        case 'f': filter.from = optarg; break;
+        case 't': filter.to = optarg; break;
+        case 'l': filter.level = std::string(" [") + optarg + "] "; break;
+        default: usage();
+        }
+    }
+    if (argc - optind < 1 || argc - optind > 2) {
+        usage();
+    }
+    std::string pattern = argc - optind == 2 ? argv[optind] : "";
+    std::string path = argv[argc - 1];
+
+    Mapping log(path);
+    if (!log.data) {
+        return 1;
+    }
+    auto [first, last] = window(path, log, filter);
+
+    // The rarest string known to be in every matching line drives the scan.
+    std::string_view needle = !pattern.empty() ? pattern : filter.level;
+    static char out[1 << 16];
+    setvbuf(stdout, out, _IOFBF, sizeof(out));
+
+    const char* p = log.data + first;
+    const char* end = log.data + last;
+    bool found = false;
+    while (p < end) {
+        const char* hit = findSubstring(p, end, needle);
+        if (!hit) {
+            break;
+        }
+        const char* line_start = hit;
+        while (line_start > log.data && line_start[-1] != '\n') {
+            --line_start;
+        }
+        const char* line_end = static_cast<const char*>(memchr(hit, '\n', log.data + log.size - hit));
+        line_end = line_end ? line_end + 1 : log.data + log.size;
+
+        if (filter.matches({line_start, static_cast<std::size_t>(line_end - line_start)})) {
+            fwrite(line_start, 1, line_end - line_start, stdout);
+            found = true;
+        }
+        p = line_end;
+    }
+    return found ? 0 : 1;
+}